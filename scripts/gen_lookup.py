@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+#
+# Copyright 2022 GL-iNet. https://www.gl-inet.com/
+#
+# SPDX-License-Identifier: Apache-2.0
+
+"""Generate const perfect hash string lookup tables.
+
+Reads a table description (see src/components/lookup/gl_lookup.def) and
+writes a C file defining one struct gl_lookup_table per table. Each table
+has a power of two number of slots and a seed chosen so that every key
+hashes to its own slot, the firmware then needs a single strcmp() per
+lookup. The hash must match gl_lookup_hash() in gl_lookup.c.
+"""
+
+import argparse
+import sys
+
+FNV_OFFSET_BASIS = 2166136261
+FNV_PRIME = 16777619
+MAX_SEED = 1 << 20
+
+
+def lookup_hash(seed, key):
+    h = FNV_OFFSET_BASIS ^ seed
+    for c in key.encode():
+        h ^= c
+        h = (h * FNV_PRIME) & 0xFFFFFFFF
+    return h ^ (h >> 16)
+
+
+def parse(path):
+    includes = []
+    tables = {}
+
+    with open(path) as f:
+        for lineno, line in enumerate(f, 1):
+            fields = line.split('#', 1)[0].split()
+            if not fields:
+                continue
+
+            if fields[0] == 'include' and len(fields) == 2:
+                includes.append(fields[1])
+            elif len(fields) == 3:
+                name, key, value = fields
+                entries = tables.setdefault(name, {})
+                if key in entries:
+                    sys.exit(f'{path}:{lineno}: duplicate key "{key}" in table {name}')
+                entries[key] = value
+            else:
+                sys.exit(f'{path}:{lineno}: expected "<table> <key> <value>"')
+
+    return includes, tables
+
+
+def find_seed(keys):
+    size = 1
+    while size < len(keys):
+        size <<= 1
+
+    while True:
+        mask = size - 1
+        for seed in range(MAX_SEED):
+            slots = {lookup_hash(seed, k) & mask for k in keys}
+            if len(slots) == len(keys):
+                return seed, mask
+        size <<= 1
+
+
+def generate(includes, tables):
+    out = ['/* Generated by scripts/gen_lookup.py, do not edit */', '',
+           '#include <zephyr/kernel.h>', '']
+    out += [f'#include "{h}"' for h in includes + ['gl_lookup.h']]
+
+    for name, entries in tables.items():
+        seed, mask = find_seed(list(entries))
+        slots = [None] * (mask + 1)
+        for key, value in entries.items():
+            slots[lookup_hash(seed, key) & mask] = (key, value)
+
+        out += ['', f'static const struct gl_lookup_entry {name}_entries[] = {{']
+        for slot in slots:
+            if slot is None:
+                out.append('\t{ NULL, GL_LOOKUP_NONE },')
+            else:
+                out.append(f'\t{{ "{slot[0]}", {slot[1]} }},')
+        out += ['};', '',
+                f'const struct gl_lookup_table gl_lookup_{name} = {{',
+                f'\t.entries = {name}_entries,',
+                f'\t.seed = {seed}u,',
+                f'\t.mask = {mask}u,',
+                '};']
+
+    return '\n'.join(out) + '\n'
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('input', help='table description')
+    parser.add_argument('output', help='C file to write')
+    args = parser.parse_args()
+
+    includes, tables = parse(args.input)
+
+    with open(args.output, 'w') as f:
+        f.write(generate(includes, tables))
+
+
+if __name__ == '__main__':
+    main()
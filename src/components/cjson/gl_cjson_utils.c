@@ -17,14 +17,173 @@
  limitations under the License.
  ******************************************************************************/
 
+#include <stdlib.h>
 #include <zephyr/kernel.h>
+#include <zephyr/init.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/stats/stats.h>
 
 #include "gl_cjson_utils.h"
 #include "gl_types.h"
 
 LOG_MODULE_REGISTER(gl_cjson_utils, CONFIG_GL_CJSON_UTILS_LOG_LEVEL);
 
+#ifdef CONFIG_GL_JSON_ARENA
+/* cJSON nodes hold doubles */
+#define ARENA_ALIGN 8
+
+static uint8_t __aligned(ARENA_ALIGN) arena[CONFIG_GL_JSON_ARENA_SIZE];
+static size_t arena_top;
+static size_t arena_last;
+static size_t arena_high_water;
+static size_t arena_high_water_logged;
+static bool arena_overflow;
+
+/* Thread inside a scope, its cJSON allocations come from the arena */
+static k_tid_t arena_owner;
+static int arena_depth;
+static K_MUTEX_DEFINE(arena_mutex);
+
+/* "gl_json" group of mcumgr stat */
+STATS_SECT_START(gl_json_stats)
+STATS_SECT_ENTRY32(scopes)
+STATS_SECT_ENTRY32(overflow)
+STATS_SECT_ENTRY32(high_water)
+STATS_SECT_END;
+
+STATS_NAME_START(gl_json_stats)
+STATS_NAME(gl_json_stats, scopes)
+STATS_NAME(gl_json_stats, overflow)
+STATS_NAME(gl_json_stats, high_water)
+STATS_NAME_END(gl_json_stats);
+
+static STATS_SECT_DECL(gl_json_stats) gl_json_stats;
+
+static bool arena_owns(const void *ptr)
+{
+	return (const uint8_t *)ptr >= arena && (const uint8_t *)ptr < &arena[sizeof(arena)];
+}
+
+static void *arena_malloc(size_t size)
+{
+	size_t start = ROUND_UP(arena_top, ARENA_ALIGN);
+
+	if (arena_owner != k_current_get()) {
+		return malloc(size);
+	}
+
+	if (start + size > sizeof(arena)) {
+		/* The rest of this scope spills to the heap */
+		arena_overflow = true;
+		return malloc(size);
+	}
+
+	arena_last = start;
+	arena_top = start + size;
+	arena_high_water = MAX(arena_high_water, arena_top);
+
+	return &arena[start];
+}
+
+static void arena_free(void *ptr)
+{
+	if (!arena_owns(ptr)) {
+		free(ptr);
+		return;
+	}
+
+	/* Released at the end of the scope, only the latest block is handed back
+	 * at once: print buffers grow by allocating anew and freeing the old one.
+	 */
+	if (arena_owner == k_current_get() && ptr == &arena[arena_last]) {
+		arena_top = arena_last;
+	}
+}
+
+int gl_json_arena_begin(k_timeout_t timeout)
+{
+	if (k_mutex_lock(&arena_mutex, timeout)) {
+		return -EBUSY;
+	}
+
+	if (arena_depth++ == 0) {
+		arena_owner = k_current_get();
+	}
+
+	return 0;
+}
+
+void gl_json_arena_end(void)
+{
+	if (arena_owner != k_current_get()) {
+		return;
+	}
+
+	if (--arena_depth == 0) {
+		STATS_INC(gl_json_stats, scopes);
+#ifdef CONFIG_STATS
+		gl_json_stats.high_water = arena_high_water;
+#endif
+
+		if (arena_overflow) {
+			LOG_WRN("JSON arena of %d bytes exhausted, heap used",
+				CONFIG_GL_JSON_ARENA_SIZE);
+			STATS_INC(gl_json_stats, overflow);
+			arena_overflow = false;
+		}
+
+		if (arena_high_water > arena_high_water_logged) {
+			LOG_INF("JSON arena high water mark %zu of %d bytes", arena_high_water,
+				CONFIG_GL_JSON_ARENA_SIZE);
+			arena_high_water_logged = arena_high_water;
+		}
+
+		arena_top = 0;
+		arena_owner = NULL;
+	}
+
+	k_mutex_unlock(&arena_mutex);
+}
+
+size_t gl_json_arena_high_water(void)
+{
+	return arena_high_water;
+}
+
+static int json_arena_setup(const struct device *dev)
+{
+	cJSON_Hooks hooks = {
+		.malloc_fn = arena_malloc,
+		.free_fn = arena_free,
+	};
+
+	ARG_UNUSED(dev);
+
+	cJSON_InitHooks(&hooks);
+	STATS_INIT_AND_REG(gl_json_stats, STATS_SIZE_32, "gl_json");
+
+	return 0;
+}
+
+SYS_INIT(json_arena_setup, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
+#else
+int gl_json_arena_begin(k_timeout_t timeout)
+{
+	ARG_UNUSED(timeout);
+
+	return -ENOTSUP;
+}
+
+void gl_json_arena_end(void)
+{
+}
+
+size_t gl_json_arena_high_water(void)
+{
+	return 0;
+}
+#endif /* CONFIG_GL_JSON_ARENA */
+
 int gl_json_add_obj(cJSON *obj, const char *key, cJSON *val)
 {
 	cJSON_AddItemToObject(obj, key, val);
@@ -21,6 +21,7 @@
 #define _GL_CJSON_UTILS_H_
 
 #include <stdbool.h>
+#include <zephyr/kernel.h>
 #include <cJSON.h>
 #include <cJSON_os.h>
 
@@ -33,4 +34,28 @@ bool gl_json_get_boolean(cJSON *obj, const char *key);
 int gl_json_get_int(cJSON *obj, const char *key);
 char *gl_json_get_string(cJSON *obj, const char *key);
 
+/** @brief Take cJSON allocations of the calling thread from the JSON arena.
+ *
+ * Everything cJSON allocates until gl_json_arena_end() comes from a fixed
+ * arena of CONFIG_GL_JSON_ARENA_SIZE bytes, released in one step at the
+ * end. Nothing allocated in the scope may be used after it, strings from
+ * cJSON_Print() must be released with cJSON_free(). Other threads keep
+ * using the heap. Scopes of one thread may nest.
+ *
+ * @param[in] timeout how long to wait while another thread owns the arena.
+ *
+ * @return 0 on success, -EBUSY or -ENOTSUP when the heap is used instead.
+ */
+int gl_json_arena_begin(k_timeout_t timeout);
+
+/** @brief End the scope started by gl_json_arena_begin() and reset the arena.
+ *
+ * Does nothing if the calling thread does not own the arena.
+ */
+void gl_json_arena_end(void);
+
+/** @brief Most arena bytes a scope has used since boot.
+ */
+size_t gl_json_arena_high_water(void);
+
 #endif /* _GL_CJSON_UTILS_H_ */
\ No newline at end of file
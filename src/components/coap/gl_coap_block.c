@@ -0,0 +1,422 @@
+/*****************************************************************************
+ * @file  gl_coap_block.c
+ * @brief Block-wise transfer (RFC 7959) for the cmd resource.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "gl_coap_block.h"
+
+LOG_MODULE_REGISTER(gl_coap_block, CONFIG_GL_COAP_UTILS_LOG_LEVEL);
+
+/* How long a transfer may pause between two blocks */
+#define BLOCK_SESSION_TIMEOUT 10000
+
+#define BLOCK_SIZE(szx) (1U << ((szx) + 4))
+#define BLOCK_SZX_RESERVED 7
+#define BLOCK_SZX_DEFAULT (__builtin_ctz(CONFIG_GL_COAP_BLOCK_SIZE) - 4)
+
+BUILD_ASSERT((CONFIG_GL_COAP_BLOCK_SIZE & (CONFIG_GL_COAP_BLOCK_SIZE - 1)) == 0,
+	     "CONFIG_GL_COAP_BLOCK_SIZE must be a power of two");
+
+struct block_option {
+	uint32_t num;
+	bool more;
+	uint8_t szx;
+};
+
+struct block_peer {
+	otIp6Address addr;
+	uint16_t port;
+};
+
+struct block_response {
+	otCoapCode code;
+	const struct block_option *block2;
+	const struct block_option *block1;
+	uint32_t size2;
+	uint32_t size1;
+	const void *payload;
+	uint16_t payload_size;
+};
+
+/* Request being reassembled. Only used from the OpenThread thread. */
+static char rx_buf[CONFIG_GL_COAP_BLOCK_BUF_SIZE];
+static uint16_t rx_len;
+static struct block_peer rx_peer;
+static int64_t rx_expire;
+
+/* Block options of the request last completed, echoed in its response */
+static struct block_option rx_block1;
+static bool rx_block1_used;
+static uint8_t rx_block2_szx;
+
+/* Response served block by block */
+static char tx_buf[CONFIG_GL_COAP_BLOCK_BUF_SIZE];
+static uint16_t tx_len;
+static struct block_peer tx_peer;
+static int64_t tx_expire;
+
+static void block_peer_set(struct block_peer *peer, const otMessageInfo *message_info)
+{
+	peer->addr = message_info->mPeerAddr;
+	peer->port = message_info->mPeerPort;
+}
+
+static bool block_peer_match(const struct block_peer *peer, const otMessageInfo *message_info)
+{
+	return peer->port == message_info->mPeerPort &&
+	       otIp6IsAddressEqual(&peer->addr, &message_info->mPeerAddr);
+}
+
+static int block_option_get(otMessage *message, uint16_t number, struct block_option *block)
+{
+	otCoapOptionIterator iterator;
+	uint64_t value;
+
+	if (otCoapOptionIteratorInit(&iterator, message) != OT_ERROR_NONE ||
+	    otCoapOptionIteratorGetFirstOptionMatching(&iterator, number) == NULL ||
+	    otCoapOptionIteratorGetOptionUintValue(&iterator, &value) != OT_ERROR_NONE) {
+		return -ENOENT;
+	}
+
+	block->num = value >> 4;
+	block->more = (value >> 3) & 1;
+	block->szx = value & 7;
+
+	return block->szx == BLOCK_SZX_RESERVED ? -EINVAL : 0;
+}
+
+static otError block_send(const uint8_t *token, uint8_t token_len,
+			  const otMessageInfo *message_info, const struct block_response *resp)
+{
+	otInstance *instance = openthread_get_default_instance();
+	otError error = OT_ERROR_NO_BUFS;
+	otMessage *response;
+
+	response = otCoapNewMessage(instance, NULL);
+	if (response == NULL) {
+		LOG_ERR("otCoapNewMessage failed.");
+		goto end;
+	}
+
+	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, resp->code);
+
+	error = otCoapMessageSetToken(response, token, token_len);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	/* Options go in ascending option number order */
+	if (resp->block2 != NULL) {
+		error = otCoapMessageAppendBlock2Option(response, resp->block2->num,
+							resp->block2->more,
+							(otCoapBlockSzx)resp->block2->szx);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (resp->block1 != NULL) {
+		error = otCoapMessageAppendBlock1Option(response, resp->block1->num,
+							resp->block1->more,
+							(otCoapBlockSzx)resp->block1->szx);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (resp->size2) {
+		error = otCoapMessageAppendUintOption(response, OT_COAP_OPTION_SIZE2, resp->size2);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (resp->size1) {
+		error = otCoapMessageAppendUintOption(response, OT_COAP_OPTION_SIZE1, resp->size1);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	if (resp->payload_size) {
+		error = otCoapMessageSetPayloadMarker(response);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+
+		error = otMessageAppend(response, resp->payload, resp->payload_size);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	error = otCoapSendResponse(instance, response, message_info);
+
+end:
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to send response: %d", error);
+		if (response != NULL) {
+			otMessageFree(response);
+		}
+	}
+
+	return error;
+}
+
+static otError block_respond(otMessage *request, const otMessageInfo *message_info,
+			     const struct block_response *resp)
+{
+	return block_send(otCoapMessageGetToken(request), otCoapMessageGetTokenLength(request),
+			  message_info, resp);
+}
+
+static void block_respond_code(otMessage *request, const otMessageInfo *message_info,
+			       otCoapCode code)
+{
+	struct block_response resp = {
+		.code = code,
+	};
+
+	block_respond(request, message_info, &resp);
+}
+
+static void block_tx_next(otMessage *request, const otMessageInfo *message_info,
+			  const struct block_option *block2)
+{
+	uint32_t size = BLOCK_SIZE(block2->szx);
+	uint32_t start = block2->num * size;
+	int64_t now = k_uptime_get();
+	struct block_option next = *block2;
+	struct block_response resp = {
+		.code = OT_COAP_CODE_CONTENT,
+		.block2 = &next,
+	};
+
+	if (tx_expire <= now || !block_peer_match(&tx_peer, message_info) || start >= tx_len) {
+		LOG_WRN("Block2 %d requested without a matching response", block2->num);
+		block_respond_code(request, message_info, OT_COAP_CODE_REQUEST_INCOMPLETE);
+		return;
+	}
+
+	next.more = start + size < tx_len;
+	resp.payload = &tx_buf[start];
+	resp.payload_size = MIN(size, tx_len - start);
+	tx_expire = next.more ? now + BLOCK_SESSION_TIMEOUT : 0;
+
+	block_respond(request, message_info, &resp);
+}
+
+static int block_rx_single(otMessage *request, const otMessageInfo *message_info,
+			   char **payload)
+{
+	uint16_t offset = otMessageGetOffset(request);
+	uint16_t length = otMessageGetLength(request) - offset;
+	struct block_response resp = {
+		.code = OT_COAP_CODE_REQUEST_TOO_LARGE,
+		.size1 = sizeof(rx_buf) - 1,
+	};
+
+	if (length >= sizeof(rx_buf)) {
+		LOG_WRN("Request of %d bytes does not fit, use Block1", length);
+		block_respond(request, message_info, &resp);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	rx_len = otMessageRead(request, offset, rx_buf, length);
+	rx_buf[rx_len] = '\0';
+	*payload = rx_buf;
+
+	return COAP_BLOCK_COMPLETE;
+}
+
+int coap_block_rx(otMessage *request, const otMessageInfo *message_info, char **payload)
+{
+	struct block_option block1;
+	struct block_option block2;
+	uint16_t offset = otMessageGetOffset(request);
+	uint16_t length = otMessageGetLength(request) - offset;
+	int64_t now = k_uptime_get();
+	int ret;
+	struct block_response resp = {
+		.code = OT_COAP_CODE_CONTINUE,
+		.block1 = &block1,
+	};
+
+	rx_block1_used = false;
+	rx_block2_szx = BLOCK_SZX_DEFAULT;
+
+	ret = block_option_get(request, OT_COAP_OPTION_BLOCK2, &block2);
+	if (ret == 0) {
+		/* The client asks for a block size or for the next response block */
+		rx_block2_szx = MIN(block2.szx, rx_block2_szx);
+		if (block2.num > 0) {
+			block_tx_next(request, message_info, &block2);
+			return COAP_BLOCK_HANDLED;
+		}
+	} else if (ret == -EINVAL) {
+		block_respond_code(request, message_info, OT_COAP_CODE_BAD_OPTION);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	/* One transfer at a time, the buffer belongs to it until it completes */
+	if (rx_expire > now && !block_peer_match(&rx_peer, message_info)) {
+		LOG_WRN("Block1 transfer in progress, request rejected");
+		block_respond_code(request, message_info, OT_COAP_CODE_SERVICE_UNAVAILABLE);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	ret = block_option_get(request, OT_COAP_OPTION_BLOCK1, &block1);
+	if (ret == -ENOENT) {
+		rx_expire = 0;
+		return block_rx_single(request, message_info, payload);
+	} else if (ret) {
+		block_respond_code(request, message_info, OT_COAP_CODE_BAD_OPTION);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	if (block1.num == 0) {
+		rx_len = 0;
+		block_peer_set(&rx_peer, message_info);
+	} else if (rx_expire <= now || block1.num * BLOCK_SIZE(block1.szx) != rx_len) {
+		LOG_WRN("Block1 %d out of sequence", block1.num);
+		rx_expire = 0;
+		block_respond_code(request, message_info, OT_COAP_CODE_REQUEST_INCOMPLETE);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	if (block1.more && length != BLOCK_SIZE(block1.szx)) {
+		rx_expire = 0;
+		block_respond_code(request, message_info, OT_COAP_CODE_BAD_REQUEST);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	if (rx_len + length >= sizeof(rx_buf)) {
+		LOG_WRN("Block1 transfer exceeds %zu bytes", sizeof(rx_buf) - 1);
+		rx_expire = 0;
+		resp.code = OT_COAP_CODE_REQUEST_TOO_LARGE;
+		resp.block1 = NULL;
+		resp.size1 = sizeof(rx_buf) - 1;
+		block_respond(request, message_info, &resp);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	rx_len += otMessageRead(request, offset, &rx_buf[rx_len], length);
+
+	if (block1.more) {
+		rx_expire = now + BLOCK_SESSION_TIMEOUT;
+		block_respond(request, message_info, &resp);
+		return COAP_BLOCK_HANDLED;
+	}
+
+	rx_expire = 0;
+	rx_buf[rx_len] = '\0';
+	rx_block1 = block1;
+	rx_block1_used = true;
+	*payload = rx_buf;
+
+	LOG_DBG("Block1 transfer of %d bytes complete", rx_len);
+
+	return COAP_BLOCK_COMPLETE;
+}
+
+void coap_block_reply_init(struct coap_block_reply *reply, otMessage *request,
+			   const otMessageInfo *message_info)
+{
+	reply->message_info = *message_info;
+	reply->message_id = otCoapMessageGetMessageId(request);
+	reply->token_len = otCoapMessageGetTokenLength(request);
+	memcpy(reply->token, otCoapMessageGetToken(request), reply->token_len);
+	reply->block1_used = rx_block1_used;
+	reply->block1_num = rx_block1.num;
+	reply->block1_szx = rx_block1.szx;
+	reply->block2_szx = rx_block2_szx;
+}
+
+otError coap_block_reply_tx(const struct coap_block_reply *reply, const char *payload,
+			    uint16_t payload_size)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	struct block_option block1 = {
+		.num = reply->block1_num,
+		.more = false,
+		.szx = reply->block1_szx,
+	};
+	struct block_option block2 = {
+		.num = 0,
+		.more = true,
+		.szx = reply->block2_szx,
+	};
+	struct block_response resp = {
+		.code = OT_COAP_CODE_CONTENT,
+		.block1 = reply->block1_used ? &block1 : NULL,
+		.payload = payload,
+		.payload_size = payload_size,
+	};
+	otError error;
+
+	openthread_api_mutex_lock(context);
+
+	if (payload == NULL) {
+		resp.code = OT_COAP_CODE_INTERNAL_ERROR;
+		resp.payload_size = 0;
+	} else if (payload_size > BLOCK_SIZE(block2.szx)) {
+		if (payload_size > sizeof(tx_buf)) {
+			LOG_ERR("Response of %d bytes exceeds %zu bytes", payload_size,
+				sizeof(tx_buf));
+			resp.code = OT_COAP_CODE_INTERNAL_ERROR;
+			resp.payload_size = 0;
+		} else {
+			/* Keep the response, the client fetches the remaining blocks with Block2 */
+			memcpy(tx_buf, payload, payload_size);
+			tx_len = payload_size;
+			tx_expire = k_uptime_get() + BLOCK_SESSION_TIMEOUT;
+			block_peer_set(&tx_peer, &reply->message_info);
+
+			resp.block2 = &block2;
+			resp.size2 = payload_size;
+			resp.payload_size = BLOCK_SIZE(block2.szx);
+		}
+	}
+
+	error = block_send(reply->token, reply->token_len, &reply->message_info, &resp);
+
+	openthread_api_mutex_unlock(context);
+
+	return error;
+}
+
+bool coap_block_reply_is_single(const struct coap_block_reply *reply, uint16_t payload_size)
+{
+	return payload_size <= BLOCK_SIZE(reply->block2_szx);
+}
+
+otError coap_block_tx(otMessage *request, const otMessageInfo *message_info,
+		      const char *payload, uint16_t payload_size)
+{
+	struct coap_block_reply reply;
+
+	coap_block_reply_init(&reply, request, message_info);
+
+	return coap_block_reply_tx(&reply, payload, payload_size);
+}
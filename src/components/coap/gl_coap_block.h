@@ -0,0 +1,107 @@
+/*****************************************************************************
+ * @file  gl_coap_block.h
+ * @brief The header file of gl_coap_block.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_COAP_BLOCK_H_
+#define _GL_COAP_BLOCK_H_
+
+#include <openthread/coap.h>
+
+#define COAP_BLOCK_COMPLETE 0
+#define COAP_BLOCK_HANDLED 1
+
+/* What is needed to answer a request after it was released */
+struct coap_block_reply {
+	otMessageInfo message_info;
+	uint16_t message_id;
+	uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+	uint8_t token_len;
+	bool block1_used;
+	uint32_t block1_num;
+	uint8_t block1_szx;
+	uint8_t block2_szx;
+};
+
+/** @brief Receive the payload of a request, reassembling Block1 transfers.
+ *
+ * Must be called from the OpenThread resource handler. Intermediate blocks
+ * are acknowledged with 2.31 Continue, requests for further response blocks
+ * (Block2) are served from the last response and errors are answered here.
+ * Only one transfer is reassembled at a time, into a buffer of
+ * CONFIG_GL_COAP_BLOCK_BUF_SIZE bytes.
+ *
+ * @param[in] request received request.
+ * @param[in] message_info request source.
+ * @param[out] payload complete payload, NUL terminated.
+ *
+ * @return COAP_BLOCK_COMPLETE when @p payload holds the whole request,
+ *         COAP_BLOCK_HANDLED when the request was already answered.
+ */
+int coap_block_rx(otMessage *request, const otMessageInfo *message_info, char **payload);
+
+/** @brief Respond to the request last completed by coap_block_rx().
+ *
+ * Responses larger than the block size are kept and sent block by block
+ * (Block2) as the client asks for them.
+ *
+ * @param[in] request request being answered.
+ * @param[in] message_info request source.
+ * @param[in] payload response payload.
+ * @param[in] payload_size size of @p payload.
+ *
+ * @return OT_ERROR_NONE on success.
+ */
+otError coap_block_tx(otMessage *request, const otMessageInfo *message_info,
+		      const char *payload, uint16_t payload_size);
+
+/** @brief Save how to answer the request last completed by coap_block_rx().
+ *
+ * Must be called from the OpenThread resource handler, before the next
+ * request is received.
+ *
+ * @param[out] reply reply destination.
+ * @param[in] request request to answer later.
+ * @param[in] message_info request source.
+ */
+void coap_block_reply_init(struct coap_block_reply *reply, otMessage *request,
+			   const otMessageInfo *message_info);
+
+/** @brief Send a separate response to a request saved by coap_block_reply_init().
+ *
+ * Like coap_block_tx(), but may be called from any thread once the request
+ * is gone. The response is a NON message carrying the request token.
+ *
+ * @param[in] reply reply destination.
+ * @param[in] payload response payload, NULL to answer with an internal error.
+ * @param[in] payload_size size of @p payload.
+ *
+ * @return OT_ERROR_NONE on success.
+ */
+otError coap_block_reply_tx(const struct coap_block_reply *reply, const char *payload,
+			    uint16_t payload_size);
+
+/** @brief Check whether coap_block_reply_tx() sends a response in one message.
+ *
+ * @param[in] reply reply destination.
+ * @param[in] payload_size size of the response payload.
+ *
+ * @return false if the response is split into Block2 blocks.
+ */
+bool coap_block_reply_is_single(const struct coap_block_reply *reply, uint16_t payload_size);
+
+#endif /* _GL_COAP_BLOCK_H_ */
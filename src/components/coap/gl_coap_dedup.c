@@ -0,0 +1,193 @@
+/*****************************************************************************
+ * @file  gl_coap_dedup.c
+ * @brief Duplicate detection for incoming CoAP requests.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "gl_coap_dedup.h"
+#include "gl_coap_utils.h"
+
+LOG_MODULE_REGISTER(gl_coap_dedup, CONFIG_GL_COAP_UTILS_LOG_LEVEL);
+
+struct dedup_entry {
+	otIp6Address addr;
+	uint16_t port;
+	uint16_t message_id;
+	uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+	uint8_t token_len;
+	bool in_use;
+	int64_t expire_at;
+	int64_t used_at;
+	/* Block1 option echoed in the response, when the request had one */
+	bool resp_block1_used;
+	uint32_t resp_block1_num;
+	uint8_t resp_block1_szx;
+	uint16_t resp_len;
+	char resp[CONFIG_GL_COAP_DEDUP_RESP_SIZE];
+};
+
+/* Guarded by the OpenThread API mutex */
+static struct dedup_entry entries[CONFIG_GL_COAP_DEDUP_ENTRIES];
+
+static bool dedup_match(const struct dedup_entry *entry, const otMessageInfo *message_info,
+			uint16_t message_id, const uint8_t *token, uint8_t token_len)
+{
+	return entry->message_id == message_id &&
+	       entry->port == message_info->mPeerPort &&
+	       entry->token_len == token_len &&
+	       !memcmp(entry->token, token, entry->token_len) &&
+	       otIp6IsAddressEqual(&entry->addr, &message_info->mPeerAddr);
+}
+
+static struct dedup_entry *dedup_find(const otMessageInfo *message_info, uint16_t message_id,
+				      const uint8_t *token, uint8_t token_len, int64_t now)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(entries); i++) {
+		if (entries[i].in_use && entries[i].expire_at > now &&
+		    dedup_match(&entries[i], message_info, message_id, token, token_len)) {
+			return &entries[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* A free or expired entry, else the least recently used one */
+static struct dedup_entry *dedup_alloc(int64_t now)
+{
+	struct dedup_entry *lru = &entries[0];
+
+	for (size_t i = 0; i < ARRAY_SIZE(entries); i++) {
+		if (!entries[i].in_use || entries[i].expire_at <= now) {
+			return &entries[i];
+		}
+
+		if (entries[i].used_at < lru->used_at) {
+			lru = &entries[i];
+		}
+	}
+
+	return lru;
+}
+
+static void dedup_replay(otMessage *request, const otMessageInfo *message_info,
+			 const struct dedup_entry *entry)
+{
+	otInstance *instance = openthread_get_default_instance();
+	otMessage *response;
+	otError error;
+
+	response = otCoapNewMessage(instance, NULL);
+	if (response == NULL) {
+		return;
+	}
+
+	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, OT_COAP_CODE_CONTENT);
+
+	error = otCoapMessageSetToken(response, entry->token, entry->token_len);
+	if (error == OT_ERROR_NONE && entry->resp_block1_used) {
+		error = otCoapMessageAppendBlock1Option(response, entry->resp_block1_num, false,
+							(otCoapBlockSzx)entry->resp_block1_szx);
+	}
+	if (error == OT_ERROR_NONE) {
+		error = otCoapMessageSetPayloadMarker(response);
+	}
+	if (error == OT_ERROR_NONE) {
+		error = otMessageAppend(response, entry->resp, entry->resp_len);
+	}
+	if (error == OT_ERROR_NONE) {
+		error = otCoapSendResponse(instance, response, message_info);
+	}
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to replay response: %d", error);
+		otMessageFree(response);
+	}
+}
+
+bool coap_dedup_check(otMessage *request, const otMessageInfo *message_info)
+{
+	int64_t now = k_uptime_get();
+	struct dedup_entry *entry = dedup_find(message_info, otCoapMessageGetMessageId(request),
+					       otCoapMessageGetToken(request),
+					       otCoapMessageGetTokenLength(request), now);
+
+	if (entry != NULL) {
+		entry->used_at = now;
+		STATS_INC(gl_coap_stats, rx_dup);
+
+		if (entry->resp_len) {
+			LOG_INF("Duplicate request 0x%04x, replaying response",
+				entry->message_id);
+			dedup_replay(request, message_info, entry);
+		} else {
+			LOG_INF("Duplicate request 0x%04x dropped", entry->message_id);
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
+void coap_dedup_accept(otMessage *request, const otMessageInfo *message_info)
+{
+	int64_t now = k_uptime_get();
+	struct dedup_entry *entry = dedup_alloc(now);
+
+	entry->in_use = true;
+	entry->addr = message_info->mPeerAddr;
+	entry->port = message_info->mPeerPort;
+	entry->message_id = otCoapMessageGetMessageId(request);
+	entry->token_len = otCoapMessageGetTokenLength(request);
+	memcpy(entry->token, otCoapMessageGetToken(request), entry->token_len);
+	entry->expire_at = now + CONFIG_GL_COAP_DEDUP_LIFETIME * MSEC_PER_SEC;
+	entry->used_at = now;
+	entry->resp_len = 0;
+}
+
+void coap_dedup_record(const struct coap_block_reply *reply, const void *payload,
+		       uint16_t payload_size)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	struct dedup_entry *entry;
+
+	/* Blocks after the first one can not be replayed from here */
+	if (!coap_block_reply_is_single(reply, payload_size)) {
+		return;
+	}
+
+	openthread_api_mutex_lock(context);
+
+	entry = dedup_find(&reply->message_info, reply->message_id, reply->token,
+			   reply->token_len, k_uptime_get());
+	if (entry != NULL && payload_size <= sizeof(entry->resp)) {
+		memcpy(entry->resp, payload, payload_size);
+		entry->resp_len = payload_size;
+		entry->resp_block1_used = reply->block1_used;
+		entry->resp_block1_num = reply->block1_num;
+		entry->resp_block1_szx = reply->block1_szx;
+	}
+
+	openthread_api_mutex_unlock(context);
+}
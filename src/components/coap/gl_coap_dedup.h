@@ -0,0 +1,71 @@
+/*****************************************************************************
+ * @file  gl_coap_dedup.h
+ * @brief The header file of gl_coap_dedup.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_COAP_DEDUP_H_
+#define _GL_COAP_DEDUP_H_
+
+#include <stdbool.h>
+#include <openthread/coap.h>
+
+#include "gl_coap_block.h"
+
+/** @brief Check whether a request was received before.
+ *
+ * Requests are identified by source, message ID and token, and remembered
+ * for CONFIG_GL_COAP_DEDUP_LIFETIME seconds in a small LRU cache. A
+ * duplicate is answered with the response recorded for the original, if
+ * any, and must not be executed again. Only requests passed to
+ * coap_dedup_accept() are remembered. Must be called from the OpenThread
+ * resource handler.
+ *
+ * @param[in] request received request.
+ * @param[in] message_info request source.
+ *
+ * @return true if @p request is a duplicate.
+ */
+bool coap_dedup_check(otMessage *request, const otMessageInfo *message_info);
+
+/** @brief Remember a request that was accepted for execution.
+ *
+ * Call once the request is going to run, so that a request rejected with
+ * an error or 5.03 can be retried with the same message ID and token.
+ * Intermediate Block1 blocks and requests for further Block2 blocks never
+ * get here, the block-wise transfer handles them. Must be called from the
+ * OpenThread resource handler.
+ *
+ * @param[in] request accepted request.
+ * @param[in] message_info request source.
+ */
+void coap_dedup_accept(otMessage *request, const otMessageInfo *message_info);
+
+/** @brief Record the response sent to a request passed to coap_dedup_accept().
+ *
+ * Until then a duplicate of the request is dropped silently, as it is when
+ * the response is larger than CONFIG_GL_COAP_DEDUP_RESP_SIZE or was split
+ * into Block2 blocks. The replayed response echoes the Block1 option of the
+ * request. May be called from any thread.
+ *
+ * @param[in] reply reply sent with coap_block_reply_tx().
+ * @param[in] payload response payload.
+ * @param[in] payload_size size of @p payload.
+ */
+void coap_dedup_record(const struct coap_block_reply *reply, const void *payload,
+		       uint16_t payload_size);
+
+#endif /* _GL_COAP_DEDUP_H_ */
@@ -0,0 +1,151 @@
+/*****************************************************************************
+ * @file  gl_coap_exec.c
+ * @brief Requests executed off the OpenThread thread, answered by separate responses.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "gl_coap_exec.h"
+#include "gl_coap_utils.h"
+#include "gl_workq.h"
+
+LOG_MODULE_REGISTER(gl_coap_exec, CONFIG_GL_COAP_UTILS_LOG_LEVEL);
+
+/* Max-Age of a 5.03 response, when the client may try again (s) */
+#define EXEC_RETRY_AFTER 2
+
+struct exec_job {
+	struct coap_block_reply reply;
+	char *payload;
+};
+
+/* Ring of requests waiting for the worker */
+static struct exec_job jobs[CONFIG_GL_COAP_EXEC_QUEUE_SIZE];
+static size_t jobs_head;
+static size_t jobs_count;
+static struct k_spinlock jobs_lock;
+
+static struct k_work exec_work;
+static coap_exec_fn_t exec_fn;
+
+static void exec_reject(otMessage *request, const otMessageInfo *message_info)
+{
+	otInstance *instance = openthread_get_default_instance();
+	otMessage *response;
+	otError error;
+
+	STATS_INC(gl_coap_stats, rx_busy);
+
+	response = otCoapNewMessage(instance, NULL);
+	if (response == NULL) {
+		return;
+	}
+
+	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE,
+			  OT_COAP_CODE_SERVICE_UNAVAILABLE);
+
+	error = otCoapMessageSetToken(response, otCoapMessageGetToken(request),
+				      otCoapMessageGetTokenLength(request));
+	if (error == OT_ERROR_NONE) {
+		error = otCoapMessageAppendMaxAgeOption(response, EXEC_RETRY_AFTER);
+	}
+	if (error == OT_ERROR_NONE) {
+		error = otCoapSendResponse(instance, response, message_info);
+	}
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to reject request: %d", error);
+		otMessageFree(response);
+	}
+}
+
+static void exec_process(struct k_work *item)
+{
+	struct exec_job job;
+	k_spinlock_key_t key;
+	bool more;
+
+	ARG_UNUSED(item);
+
+	key = k_spin_lock(&jobs_lock);
+	if (jobs_count == 0) {
+		k_spin_unlock(&jobs_lock, key);
+		return;
+	}
+	job = jobs[jobs_head];
+	jobs_head = (jobs_head + 1) % ARRAY_SIZE(jobs);
+	more = --jobs_count > 0;
+	k_spin_unlock(&jobs_lock, key);
+
+	exec_fn(job.payload, &job.reply);
+	free(job.payload);
+
+	/* One request per run, other work on the queue is not held up */
+	if (more) {
+		k_work_submit_to_queue(&gl_workq_lo, &exec_work);
+	}
+}
+
+void coap_exec_init(coap_exec_fn_t fn)
+{
+	exec_fn = fn;
+	k_work_init(&exec_work, exec_process);
+}
+
+int coap_exec_submit(otMessage *request, const otMessageInfo *message_info,
+		     const char *payload)
+{
+	size_t size = strlen(payload) + 1;
+	struct exec_job job;
+	k_spinlock_key_t key;
+	bool queued = false;
+
+	job.payload = malloc(size);
+	if (job.payload == NULL) {
+		LOG_ERR("No memory for request of %zu bytes", size);
+		exec_reject(request, message_info);
+		return -ENOMEM;
+	}
+	memcpy(job.payload, payload, size);
+
+	coap_block_reply_init(&job.reply, request, message_info);
+
+	key = k_spin_lock(&jobs_lock);
+	if (jobs_count < ARRAY_SIZE(jobs)) {
+		jobs[(jobs_head + jobs_count) % ARRAY_SIZE(jobs)] = job;
+		jobs_count++;
+		queued = true;
+	}
+	k_spin_unlock(&jobs_lock, key);
+
+	if (!queued) {
+		LOG_WRN("Request queue full, request rejected");
+		free(job.payload);
+		exec_reject(request, message_info);
+		return -ENOMEM;
+	}
+
+	k_work_submit_to_queue(&gl_workq_lo, &exec_work);
+
+	return 0;
+}
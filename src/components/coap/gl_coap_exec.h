@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * @file  gl_coap_exec.h
+ * @brief The header file of gl_coap_exec.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_COAP_EXEC_H_
+#define _GL_COAP_EXEC_H_
+
+#include <openthread/coap.h>
+
+#include "gl_coap_block.h"
+
+/* Runs a queued request and answers it with coap_block_reply_tx() */
+typedef void (*coap_exec_fn_t)(const char *payload, const struct coap_block_reply *reply);
+
+/** @brief Initialize the request executor.
+ *
+ * @param[in] fn function running each queued request.
+ */
+void coap_exec_init(coap_exec_fn_t fn);
+
+/** @brief Queue a request to run on the low priority work queue.
+ *
+ * Must be called from the OpenThread resource handler once coap_block_rx()
+ * completed the payload. The handler returns at once, the result follows
+ * as a separate response. Up to CONFIG_GL_COAP_EXEC_QUEUE_SIZE requests
+ * wait in order, further ones are answered with 5.03 Service Unavailable.
+ *
+ * @param[in] request received request.
+ * @param[in] message_info request source.
+ * @param[in] payload complete request payload, copied.
+ *
+ * @return 0 on success, -ENOMEM if the request was rejected.
+ */
+int coap_exec_submit(otMessage *request, const otMessageInfo *message_info,
+		     const char *payload);
+
+#endif /* _GL_COAP_EXEC_H_ */
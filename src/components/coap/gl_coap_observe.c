@@ -0,0 +1,436 @@
+/*****************************************************************************
+ * @file  gl_coap_observe.c
+ * @brief Observable resource support (RFC 7641).
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
+
+#include "gl_coap_observe.h"
+#include "gl_workq.h"
+
+#ifdef CONFIG_GL_COAP_OBSERVE
+
+LOG_MODULE_REGISTER(gl_coap_observe, CONFIG_GL_COAP_UTILS_LOG_LEVEL);
+
+#define OBSERVE_REGISTER 0
+#define OBSERVE_DEREGISTER 1
+#define OBSERVE_SEQ_MASK 0xffffff
+
+/* Retry hint sent while no representation has been built yet */
+#define OBSERVE_RETRY_AFTER 2
+
+#define MAX_AGE_QUERY "max-age="
+
+#define OBSERVER_HANDLE(idx, gen) ((void *)(uintptr_t)(((gen) << 8) | (idx)))
+#define OBSERVER_HANDLE_IDX(h) ((uintptr_t)(h) & 0xff)
+#define OBSERVER_HANDLE_GEN(h) (((uintptr_t)(h) >> 8) & 0xff)
+
+struct coap_observer {
+	otIp6Address addr;
+	uint16_t port;
+	uint8_t token[OT_COAP_MAX_TOKEN_LENGTH];
+	uint8_t token_len;
+	uint8_t gen;
+	bool in_use;
+	uint8_t since_con;
+	uint32_t max_age;
+	int64_t registered_at;
+	int64_t next_due;
+};
+
+/* Observer registry and last representation. Only touched with the
+ * OpenThread API mutex held, which is also held while OpenThread runs the
+ * resource handler.
+ */
+static struct coap_observer observers[CONFIG_GL_COAP_OBSERVERS_MAX];
+static char representation[CONFIG_GL_COAP_OBSERVE_PAYLOAD_SIZE];
+static uint16_t representation_len;
+static int64_t representation_at;
+static uint32_t observe_seq;
+
+/* Built outside of the mutex, then copied into representation */
+static char build_buf[CONFIG_GL_COAP_OBSERVE_PAYLOAD_SIZE];
+static coap_observe_build_t build_cb;
+static struct k_work_delayable observe_work;
+static bool refresh_requested;
+
+static bool observer_match(const struct coap_observer *observer, const otMessage *request,
+			   const otMessageInfo *message_info)
+{
+	return observer->in_use && observer->port == message_info->mPeerPort &&
+	       otIp6IsAddressEqual(&observer->addr, &message_info->mPeerAddr) &&
+	       observer->token_len == otCoapMessageGetTokenLength(request) &&
+	       !memcmp(observer->token, otCoapMessageGetToken(request), observer->token_len);
+}
+
+static int observe_option_get(otMessage *request, uint64_t *value)
+{
+	otCoapOptionIterator iterator;
+
+	if (otCoapOptionIteratorInit(&iterator, request) != OT_ERROR_NONE ||
+	    otCoapOptionIteratorGetFirstOptionMatching(&iterator, OT_COAP_OPTION_OBSERVE) == NULL ||
+	    otCoapOptionIteratorGetOptionUintValue(&iterator, value) != OT_ERROR_NONE) {
+		return -ENOENT;
+	}
+
+	return 0;
+}
+
+static uint32_t observe_max_age_get(otMessage *request, uint32_t default_max_age)
+{
+	otCoapOptionIterator iterator;
+	const otCoapOption *option;
+	char query[sizeof(MAX_AGE_QUERY) + 10];
+	uint32_t max_age = default_max_age;
+
+	if (otCoapOptionIteratorInit(&iterator, request) != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	for (option = otCoapOptionIteratorGetFirstOptionMatching(&iterator,
+								  OT_COAP_OPTION_URI_QUERY);
+	     option != NULL;
+	     option = otCoapOptionIteratorGetNextOptionMatching(&iterator,
+								 OT_COAP_OPTION_URI_QUERY)) {
+		if (option->mLength >= sizeof(query) ||
+		    otCoapOptionIteratorGetOptionValue(&iterator, query) != OT_ERROR_NONE) {
+			continue;
+		}
+
+		query[option->mLength] = '\0';
+		if (!strncmp(query, MAX_AGE_QUERY, strlen(MAX_AGE_QUERY))) {
+			max_age = strtoul(query + strlen(MAX_AGE_QUERY), NULL, 10);
+		}
+	}
+
+end:
+	return MAX(max_age, CONFIG_GL_COAP_OBSERVE_MIN_MAX_AGE);
+}
+
+/* Seconds the cached representation stays fresh for a given max-age */
+static uint32_t representation_freshness(uint32_t max_age, int64_t now)
+{
+	int64_t age = (now - representation_at) / MSEC_PER_SEC;
+
+	return age < max_age ? max_age - age : 1;
+}
+
+static otError observe_append_representation(otMessage *message, uint32_t max_age,
+					     int64_t now)
+{
+	otError error;
+
+	error = otCoapMessageAppendContentFormatOption(message,
+						       OT_COAP_OPTION_CONTENT_FORMAT_JSON);
+	if (error != OT_ERROR_NONE) {
+		return error;
+	}
+
+	error = otCoapMessageAppendMaxAgeOption(message, representation_freshness(max_age, now));
+	if (error != OT_ERROR_NONE) {
+		return error;
+	}
+
+	error = otCoapMessageSetPayloadMarker(message);
+	if (error != OT_ERROR_NONE) {
+		return error;
+	}
+
+	return otMessageAppend(message, representation, representation_len);
+}
+
+static void observe_respond(otMessage *request, const otMessageInfo *message_info,
+			    const struct coap_observer *observer, uint32_t max_age)
+{
+	otInstance *instance = openthread_get_default_instance();
+	bool available = representation_len > 0;
+	otMessage *response;
+	otError error;
+
+	response = otCoapNewMessage(instance, NULL);
+	if (response == NULL) {
+		LOG_ERR("Failed to allocate status response");
+		return;
+	}
+
+	error = otCoapMessageInitResponse(response, request,
+					  otCoapMessageGetType(request) ==
+							  OT_COAP_TYPE_CONFIRMABLE ?
+						  OT_COAP_TYPE_ACKNOWLEDGEMENT :
+						  OT_COAP_TYPE_NON_CONFIRMABLE,
+					  available ? OT_COAP_CODE_CONTENT :
+						      OT_COAP_CODE_SERVICE_UNAVAILABLE);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	if (!available) {
+		error = otCoapMessageAppendMaxAgeOption(response, OBSERVE_RETRY_AFTER);
+		goto send;
+	}
+
+	if (observer != NULL) {
+		error = otCoapMessageAppendObserveOption(response, observe_seq & OBSERVE_SEQ_MASK);
+		if (error != OT_ERROR_NONE) {
+			goto end;
+		}
+	}
+
+	error = observe_append_representation(response, max_age, k_uptime_get());
+
+send:
+	if (error == OT_ERROR_NONE) {
+		error = otCoapSendResponse(instance, response, message_info);
+	}
+
+end:
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to send status response: %d", error);
+		otMessageFree(response);
+	}
+}
+
+static void on_con_notification_done(void *context, otMessage *message,
+				     const otMessageInfo *message_info, otError result)
+{
+	struct coap_observer *observer = &observers[OBSERVER_HANDLE_IDX(context)];
+
+	ARG_UNUSED(message);
+	ARG_UNUSED(message_info);
+
+	/* A reset means the client lost interest. A timeout cannot tell a lost
+	 * client from an acknowledged notification, so it is not acted upon.
+	 */
+	if (result == OT_ERROR_ABORT && observer->in_use &&
+	    observer->gen == OBSERVER_HANDLE_GEN(context)) {
+		LOG_INF("Observer rejected notification, removed");
+		observer->in_use = false;
+	}
+}
+
+static void observe_send(otInstance *instance, size_t idx, int64_t now)
+{
+	struct coap_observer *observer = &observers[idx];
+	bool con = ++observer->since_con >= CONFIG_GL_COAP_OBSERVE_CON_INTERVAL;
+	otMessageInfo message_info;
+	otMessage *message;
+	otError error;
+
+	observer->next_due = now + (int64_t)observer->max_age * MSEC_PER_SEC;
+
+	message = otCoapNewMessage(instance, NULL);
+	if (message == NULL) {
+		LOG_ERR("Failed to allocate notification");
+		return;
+	}
+
+	otCoapMessageInit(message, con ? OT_COAP_TYPE_CONFIRMABLE : OT_COAP_TYPE_NON_CONFIRMABLE,
+			  OT_COAP_CODE_CONTENT);
+
+	error = otCoapMessageSetToken(message, observer->token, observer->token_len);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = otCoapMessageAppendObserveOption(message, observe_seq & OBSERVE_SEQ_MASK);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	error = observe_append_representation(message, observer->max_age, now);
+	if (error != OT_ERROR_NONE) {
+		goto end;
+	}
+
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = observer->addr;
+	message_info.mPeerPort = observer->port;
+
+	/* Confirmable now and then, so that a gone client can answer with a reset */
+	if (con) {
+		observer->since_con = 0;
+		error = otCoapSendRequest(instance, message, &message_info,
+					  on_con_notification_done,
+					  OBSERVER_HANDLE(idx, observer->gen));
+	} else {
+		error = otCoapSendRequest(instance, message, &message_info, NULL, NULL);
+	}
+
+end:
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to send notification: %d", error);
+		otMessageFree(message);
+	}
+}
+
+/* Called with the OpenThread API mutex held */
+static void observe_notify_locked(const uint8_t *payload, uint16_t payload_size, bool all)
+{
+	otInstance *instance = openthread_get_default_instance();
+	int64_t now = k_uptime_get();
+
+	if (payload_size > sizeof(representation)) {
+		LOG_ERR("Representation too large: %d", payload_size);
+		return;
+	}
+
+	memcpy(representation, payload, payload_size);
+	representation_len = payload_size;
+	representation_at = now;
+	observe_seq++;
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observers[i].in_use && (all || observers[i].next_due <= now)) {
+			observe_send(instance, i, now);
+		}
+	}
+}
+
+static int64_t observe_next_due(void)
+{
+	int64_t next = INT64_MAX;
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observers[i].in_use) {
+			next = MIN(next, observers[i].next_due);
+		}
+	}
+
+	return next;
+}
+
+static void observe_update(struct k_work *item)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	int64_t now = k_uptime_get();
+	int64_t next;
+	bool refresh;
+
+	ARG_UNUSED(item);
+
+	openthread_api_mutex_lock(context);
+	next = observe_next_due();
+	refresh = refresh_requested || next <= now;
+	refresh_requested = false;
+	openthread_api_mutex_unlock(context);
+
+	if (refresh && build_cb(build_buf, sizeof(build_buf)) == 0) {
+		openthread_api_mutex_lock(context);
+		observe_notify_locked((const uint8_t *)build_buf, strlen(build_buf) + 1, false);
+		next = observe_next_due();
+		openthread_api_mutex_unlock(context);
+	}
+
+	if (next != INT64_MAX) {
+		k_work_reschedule_for_queue(&gl_workq_lo, &observe_work,
+					    K_MSEC(MAX(next - k_uptime_get(), 0)));
+	}
+}
+
+static struct coap_observer *observer_alloc(void)
+{
+	struct coap_observer *oldest = &observers[0];
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (!observers[i].in_use) {
+			return &observers[i];
+		}
+
+		if (observers[i].registered_at < oldest->registered_at) {
+			oldest = &observers[i];
+		}
+	}
+
+	/* Clients re-register from time to time, the stalest one is likely gone */
+	LOG_WRN("Observer registry full, replacing the oldest registration");
+	return oldest;
+}
+
+void coap_observe_init(coap_observe_build_t build)
+{
+	build_cb = build;
+	k_work_init_delayable(&observe_work, observe_update);
+}
+
+void coap_observe_request(otMessage *request, const otMessageInfo *message_info,
+			  uint32_t default_max_age)
+{
+	struct coap_observer *observer = NULL;
+	uint32_t max_age = observe_max_age_get(request, default_max_age);
+	int64_t now = k_uptime_get();
+	uint64_t observe;
+
+	for (size_t i = 0; i < ARRAY_SIZE(observers); i++) {
+		if (observer_match(&observers[i], request, message_info)) {
+			observer = &observers[i];
+			break;
+		}
+	}
+
+	if (observe_option_get(request, &observe) || observe != OBSERVE_REGISTER ||
+	    representation_len == 0) {
+		/* Deregistration, plain GET, or nothing to register for yet */
+		if (observer != NULL) {
+			LOG_INF("Observer removed");
+			observer->in_use = false;
+			observer = NULL;
+		}
+	} else {
+		if (observer == NULL) {
+			observer = observer_alloc();
+			observer->gen++;
+			observer->since_con = 0;
+			LOG_INF("Observer added, max-age %ds", max_age);
+		}
+
+		observer->in_use = true;
+		observer->addr = message_info->mPeerAddr;
+		observer->port = message_info->mPeerPort;
+		observer->token_len = otCoapMessageGetTokenLength(request);
+		memcpy(observer->token, otCoapMessageGetToken(request), observer->token_len);
+		observer->max_age = max_age;
+		observer->registered_at = now;
+		observer->next_due = representation_at + (int64_t)max_age * MSEC_PER_SEC;
+	}
+
+	observe_respond(request, message_info, observer, max_age);
+
+	if (representation_len == 0) {
+		refresh_requested = true;
+	}
+
+	if (refresh_requested || observer != NULL) {
+		k_work_reschedule_for_queue(&gl_workq_lo, &observe_work, K_NO_WAIT);
+	}
+}
+
+void coap_observe_notify(const uint8_t *payload, uint16_t payload_size)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(context);
+	observe_notify_locked(payload, payload_size, true);
+	openthread_api_mutex_unlock(context);
+}
+
+#endif /* CONFIG_GL_COAP_OBSERVE */
@@ -0,0 +1,65 @@
+/*****************************************************************************
+ * @file  gl_coap_observe.h
+ * @brief The header file of gl_coap_observe.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+ 
+ http://www.apache.org/licenses/LICENSE-2.0
+ 
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_COAP_OBSERVE_H_
+#define _GL_COAP_OBSERVE_H_
+
+#include <stddef.h>
+#include <openthread/coap.h>
+
+/** @brief Build the current representation of the observed resource.
+ *
+ * Runs on the low priority work queue, so it may fetch sensors.
+ *
+ * @param[out] buf representation, NUL terminated.
+ * @param[in] size size of @p buf.
+ *
+ * @return 0 on success, negative errno otherwise.
+ */
+typedef int (*coap_observe_build_t)(char *buf, size_t size);
+
+/** @brief Initialize the observer registry.
+ *
+ * @param[in] build callback building the representation sent to observers.
+ */
+void coap_observe_init(coap_observe_build_t build);
+
+/** @brief Handle a GET on the observable resource.
+ *
+ * Called from the OpenThread resource handler. A GET with Observe 0
+ * registers the client, Observe 1 removes it, a plain GET is answered once.
+ * The client may ask for a notification interval with a "max-age=<s>" URI
+ * query, else @p default_max_age is used. The response is sent separately
+ * from the low priority work queue.
+ *
+ * @param[in] request received request.
+ * @param[in] message_info request source.
+ * @param[in] default_max_age notification interval in seconds.
+ */
+void coap_observe_request(otMessage *request, const otMessageInfo *message_info,
+			  uint32_t default_max_age);
+
+/** @brief Notify every observer of a new representation.
+ *
+ * @param[in] payload representation.
+ * @param[in] payload_size size of @p payload.
+ */
+void coap_observe_notify(const uint8_t *payload, uint16_t payload_size);
+
+#endif /* _GL_COAP_OBSERVE_H_ */
@@ -17,234 +17,224 @@
  limitations under the License.
  ******************************************************************************/
 
+#include <string.h>
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
-#include <zephyr/net/coap.h>
-#include <net/coap_utils.h>
-#include <zephyr/net/socket.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/coap.h>
+#include <openthread/message.h>
 
 #include "gl_coap_utils.h"
+#include "gl_poll_ctrl.h"
 
 LOG_MODULE_REGISTER(gl_coap_utils, CONFIG_GL_COAP_UTILS_LOG_LEVEL);
 
-const static int nfds = 1;
-static struct pollfd fds;
-static struct coap_reply replies[COAP_MAX_REPLIES];
-static int proto_family;
-static struct sockaddr *bind_addr;
-
-static K_THREAD_STACK_DEFINE(receive_stack_area, COAP_RECEIVE_STACK_SIZE);
-static struct k_thread receive_thread_data;
-
-static int coap_open_socket(void)
+STATS_NAME_START(gl_coap_stats)
+STATS_NAME(gl_coap_stats, tx)
+STATS_NAME(gl_coap_stats, tx_err)
+STATS_NAME(gl_coap_stats, reply)
+STATS_NAME(gl_coap_stats, reply_timeout)
+STATS_NAME(gl_coap_stats, reply_no_slot)
+STATS_NAME(gl_coap_stats, rx_cmd)
+STATS_NAME(gl_coap_stats, rx_err)
+STATS_NAME(gl_coap_stats, rx_dup)
+STATS_NAME(gl_coap_stats, rx_busy)
+STATS_NAME(gl_coap_stats, rsp_tx)
+STATS_NAME(gl_coap_stats, rsp_err)
+STATS_NAME_END(gl_coap_stats);
+
+STATS_SECT_DECL(gl_coap_stats) gl_coap_stats;
+
+struct coap_reply_slot {
+	coap_utils_reply_cb_t cb;
+	int holder;
+	bool in_use;
+	bool multicast;
+};
+
+/* Requests waiting for a reply. Only touched with the OpenThread API mutex
+ * held, which is also held while OpenThread runs the reply handlers.
+ */
+static struct coap_reply_slot replies[COAP_MAX_REPLIES];
+
+/* A NON request is never retransmitted, so OpenThread gives up on the reply
+ * one ACK timeout after sending it.
+ */
+static const otCoapTxParameters reply_tx_params = {
+	.mAckTimeout = COAP_REPLY_TIMEOUT,
+	.mAckRandomFactorNumerator = 1,
+	.mAckRandomFactorDenominator = 1,
+	.mMaxRetransmit = 0,
+};
+
+static struct coap_reply_slot *coap_reply_alloc(coap_utils_reply_cb_t cb, bool multicast)
 {
-	int sock;
-
-	while (1) {
-		sock = socket(proto_family, SOCK_DGRAM, IPPROTO_UDP);
-		if (sock < 0) {
-			LOG_ERR("Failed to create socket %d", errno);
-			k_sleep(K_MSEC(COAP_OPEN_SOCKET_SLEEP));
-			continue;
+	for (size_t i = 0; i < ARRAY_SIZE(replies); i++) {
+		if (!replies[i].in_use) {
+			replies[i].in_use = true;
+			replies[i].multicast = multicast;
+			replies[i].cb = cb;
+			/* Keep polling fast until the reply arrives or the request expires */
+			replies[i].holder = poll_ctrl_hold(COAP_REPLY_TIMEOUT);
+			return &replies[i];
 		}
-		break;
 	}
 
-	if (bind_addr) {
-		if (bind(sock, bind_addr, sizeof(*bind_addr))) {
-			LOG_ERR("Failed to bind socket, errno: %d", errno);
-		}
-	}
-
-	return sock;
+	return NULL;
 }
 
-static void coap_close_socket(int socket)
+static void coap_reply_release(struct coap_reply_slot *slot)
 {
-	(void)close(socket);
+	poll_ctrl_release(slot->holder);
+	slot->holder = POLL_CTRL_NO_HOLDER;
+	slot->in_use = false;
 }
 
-static void coap_receive(void)
+static void coap_response_handler(void *context, otMessage *message,
+				  const otMessageInfo *message_info, otError result)
 {
-	static uint8_t buf[MAX_COAP_MSG_LEN + 1];
-	struct coap_packet response;
-	struct coap_reply *reply = NULL;
-	static struct sockaddr from_addr;
-	socklen_t from_addr_len;
-	int len;
-	int ret;
-
-	while (1) {
-		fds.revents = 0;
-
-		if (poll(&fds, nfds, -1) < 0) {
-			LOG_ERR("Error in poll:%d", errno);
-			errno = 0;
-			k_sleep(K_MSEC(COAP_POOL_SLEEP));
-			continue;
-		}
-
-		if (fds.revents & POLLERR) {
-			LOG_ERR("Error in poll.. waiting a moment.");
-			k_sleep(K_MSEC(COAP_POOL_SLEEP));
-			continue;
-		}
-
-		if (fds.revents & POLLHUP) {
-			LOG_ERR("Error in poll: POLLHUP");
-			continue;
-		}
-
-		if (fds.revents & POLLNVAL) {
-			LOG_ERR("Error in poll: POLLNVAL - fd not open");
+	struct coap_reply_slot *slot = context;
+	coap_utils_reply_cb_t cb = slot->cb;
 
-			coap_close_socket(fds.fd);
-			fds.fd = coap_open_socket();
-
-			LOG_INF("Socket has been re-open");
-
-			continue;
-		}
+	ARG_UNUSED(message_info);
 
-		if (!(fds.revents & POLLIN)) {
-			LOG_ERR("Unknown poll error");
-			continue;
+	if (result != OT_ERROR_NONE) {
+		if (result != OT_ERROR_RESPONSE_TIMEOUT || !slot->multicast) {
+			LOG_DBG("No reply: %d", result);
+			STATS_INC(gl_coap_stats, reply_timeout);
+			cb(result, NULL);
 		}
+		coap_reply_release(slot);
+		return;
+	}
 
-		from_addr_len = sizeof(from_addr);
-		len = recvfrom(fds.fd, buf, sizeof(buf) - 1, 0, &from_addr, &from_addr_len);
-
-		if (len < 0) {
-			LOG_ERR("Error reading response: %d", errno);
-			errno = 0;
-			continue;
-		}
+	/* A multicast request stays open for further replies until it times out */
+	if (slot->multicast) {
+		poll_ctrl_release(slot->holder);
+		slot->holder = POLL_CTRL_NO_HOLDER;
+	} else {
+		coap_reply_release(slot);
+	}
 
-		if (len == 0) {
-			LOG_ERR("Zero length recv");
-			continue;
-		}
+	STATS_INC(gl_coap_stats, reply);
+	cb(OT_ERROR_NONE, message);
+}
 
-		ret = coap_packet_parse(&response, buf, len, NULL, 0);
-		if (ret < 0) {
-			LOG_ERR("Invalid data received");
-			continue;
-		}
+void coap_utils_init(void)
+{
+	STATS_INIT_AND_REG(gl_coap_stats, STATS_SIZE_32, "gl_coap");
 
-		reply = coap_response_received(&response, &from_addr, replies, COAP_MAX_REPLIES);
-		if (reply) {
-			coap_reply_clear(reply);
-		}
+	for (size_t i = 0; i < ARRAY_SIZE(replies); i++) {
+		replies[i].holder = POLL_CTRL_NO_HOLDER;
 	}
 }
 
-static int coap_init_request(enum coap_method method, enum coap_msgtype msg_type,
-			     const char *const *uri_path_options, uint8_t *payload,
-			     uint16_t payload_size, struct coap_packet *request, uint8_t *buf)
+/* content_format < 0 sends no Content-Format option */
+static int coap_request_send(otCoapCode code, const otIp6Address *addr, uint16_t port,
+			     const char *uri_path, int content_format, const uint8_t *payload,
+			     uint16_t payload_size, coap_utils_reply_cb_t reply_cb)
 {
-	const char *const *opt;
-	int ret;
+	struct openthread_context *context = openthread_get_default_context();
+	struct coap_reply_slot *slot = NULL;
+	otMessageInfo message_info;
+	otMessage *request;
+	otError error;
+
+	openthread_api_mutex_lock(context);
+
+	request = otCoapNewMessage(context->instance, NULL);
+	if (request == NULL) {
+		LOG_ERR("Failed to allocate CoAP request");
+		error = OT_ERROR_NO_BUFS;
+		goto end;
+	}
 
-	ret = coap_packet_init(request, buf, MAX_COAP_MSG_LEN, COAP_VER, msg_type, COAP_TOKEN_LEN,
-			       coap_next_token(), method, coap_next_id());
-	if (ret < 0) {
-		LOG_ERR("Failed to init CoAP message");
+	otCoapMessageInit(request, OT_COAP_TYPE_NON_CONFIRMABLE, code);
+	otCoapMessageGenerateToken(request, OT_COAP_DEFAULT_TOKEN_LENGTH);
+
+	error = otCoapMessageAppendUriPathOptions(request, uri_path);
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Unable add option to request");
 		goto end;
 	}
 
-	for (opt = uri_path_options; opt && *opt; opt++) {
-		ret = coap_packet_append_option(request, COAP_OPTION_URI_PATH,
-						*(const uint8_t *const *)opt, strlen(*opt));
-		if (ret < 0) {
-			LOG_ERR("Unable add option to request");
+	if (content_format >= 0) {
+		error = otCoapMessageAppendContentFormatOption(request, content_format);
+		if (error != OT_ERROR_NONE) {
+			LOG_ERR("Unable add content format to request");
 			goto end;
 		}
 	}
 
-	if (payload) {
-		ret = coap_packet_append_payload_marker(request);
-		if (ret < 0) {
+	if (payload != NULL) {
+		error = otCoapMessageSetPayloadMarker(request);
+		if (error != OT_ERROR_NONE) {
 			LOG_ERR("Unable to append payload marker");
 			goto end;
 		}
 
-		ret = coap_packet_append_payload(request, payload, payload_size);
-		if (ret < 0) {
+		error = otMessageAppend(request, payload, payload_size);
+		if (error != OT_ERROR_NONE) {
 			LOG_ERR("Not able to append payload");
 			goto end;
 		}
 	}
 
-end:
-	return ret;
-}
-
-static int coap_send_message(const struct sockaddr *addr, struct coap_packet *request)
-{
-	return sendto(fds.fd, request->data, request->offset, 0, addr, sizeof(*addr));
-}
-
-static void coap_set_response_callback(struct coap_packet *request, coap_reply_t reply_cb)
-{
-	struct coap_reply *reply;
-
-	reply = &replies[0];
-
-	coap_reply_clear(reply);
-	coap_reply_init(reply, request);
-	reply->reply = reply_cb;
-}
+	memset(&message_info, 0, sizeof(message_info));
+	message_info.mPeerAddr = *addr;
+	message_info.mPeerPort = port;
 
-void coap_init(int ip_family, struct sockaddr *addr)
-{
-	proto_family = ip_family;
-	if (addr) {
-		bind_addr = addr;
+	if (reply_cb != NULL) {
+		slot = coap_reply_alloc(reply_cb, addr->mFields.m8[0] == 0xff);
+		if (slot == NULL) {
+			LOG_WRN("No free reply slot, reply to %s ignored", uri_path);
+			STATS_INC(gl_coap_stats, reply_no_slot);
+		}
 	}
 
-	fds.events = POLLIN;
-	fds.revents = 0;
-	fds.fd = coap_open_socket();
-
-	/* start sock receive thread */
-	k_thread_create(&receive_thread_data, receive_stack_area,
-			K_THREAD_STACK_SIZEOF(receive_stack_area), (k_thread_entry_t)coap_receive,
-			NULL, NULL, NULL,
-			/* Lowest priority cooperative thread */
-			K_PRIO_COOP(CONFIG_NUM_COOP_PRIORITIES - 1), 0, K_NO_WAIT);
-	k_thread_name_set(&receive_thread_data, "CoAP-sock-recv");
-	LOG_DBG("CoAP socket receive thread started");
-}
-
-int coap_send_request(enum coap_method method, const struct sockaddr *addr,
-		      const char *const *uri_path_options, uint8_t *payload, uint16_t payload_size,
-		      coap_reply_t reply_cb)
-{
-	int ret;
-	struct coap_packet request;
-	uint8_t buf[MAX_COAP_MSG_LEN];
-
-	if (payload_size > MAX_COAP_MSG_LEN) {
-		LOG_ERR("The CoAP message length is limited to %d", MAX_COAP_MSG_LEN);
-		return -1;
+	error = otCoapSendRequestWithParameters(context->instance, request, &message_info,
+						slot ? coap_response_handler : NULL, slot,
+						&reply_tx_params);
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Transmission failed: %d", error);
+		if (slot != NULL) {
+			coap_reply_release(slot);
+		}
 	}
 
-	ret = coap_init_request(method, COAP_TYPE_NON_CON, uri_path_options, payload, payload_size,
-				&request, buf);
-	if (ret < 0) {
-		goto end;
+end:
+	if (error != OT_ERROR_NONE) {
+		STATS_INC(gl_coap_stats, tx_err);
+	} else {
+		STATS_INC(gl_coap_stats, tx);
 	}
 
-	if (reply_cb != NULL) {
-		coap_set_response_callback(&request, reply_cb);
+	if (error != OT_ERROR_NONE && request != NULL) {
+		otMessageFree(request);
 	}
 
-	ret = coap_send_message(addr, &request);
-	if (ret < 0) {
-		LOG_ERR("Transmission failed: %d", errno);
-		goto end;
+	openthread_api_mutex_unlock(context);
+
+	if (error != OT_ERROR_NONE) {
+		return -EIO;
 	}
 
-end:
-	return ret;
+	return reply_cb != NULL && slot == NULL ? COAP_UTILS_UNTRACKED : 0;
+}
+
+int coap_utils_send_request(otCoapCode code, const otIp6Address *addr, uint16_t port,
+			    const char *uri_path, const uint8_t *payload, uint16_t payload_size,
+			    coap_utils_reply_cb_t reply_cb)
+{
+	return coap_request_send(code, addr, port, uri_path, -1, payload, payload_size,
+				 reply_cb);
+}
+
+int coap_utils_send_request_format(otCoapCode code, const otIp6Address *addr, uint16_t port,
+				   const char *uri_path, otCoapOptionContentFormat format,
+				   const uint8_t *payload, uint16_t payload_size,
+				   coap_utils_reply_cb_t reply_cb)
+{
+	return coap_request_send(code, addr, port, uri_path, format, payload, payload_size,
+				 reply_cb);
 }
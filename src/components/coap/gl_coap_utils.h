@@ -20,16 +20,75 @@
 #ifndef _GL_COAP_UTILS_H_
 #define _GL_COAP_UTILS_H_
 
-#define MAX_COAP_MSG_LEN 512
-#define COAP_VER 1
-#define COAP_TOKEN_LEN 8
-#define COAP_MAX_REPLIES 1
-#define COAP_POOL_SLEEP 500
-#define COAP_OPEN_SOCKET_SLEEP 200
-#if defined(CONFIG_NRF_MODEM_LIB)
-#define COAP_RECEIVE_STACK_SIZE 1096
-#else
-#define COAP_RECEIVE_STACK_SIZE 996
-#endif
+#include <zephyr/stats/stats.h>
+#include <openthread/coap.h>
+
+#define COAP_MAX_REPLIES 4
+#define COAP_REPLY_TIMEOUT 5000
+
+/* Request sent, but no reply slot was free, so @p reply_cb is never called */
+#define COAP_UTILS_UNTRACKED 1
+
+/* CoAP counters of all modules, "gl_coap" group of mcumgr stat */
+STATS_SECT_START(gl_coap_stats)
+STATS_SECT_ENTRY32(tx)
+STATS_SECT_ENTRY32(tx_err)
+STATS_SECT_ENTRY32(reply)
+STATS_SECT_ENTRY32(reply_timeout)
+STATS_SECT_ENTRY32(reply_no_slot)
+STATS_SECT_ENTRY32(rx_cmd)
+STATS_SECT_ENTRY32(rx_err)
+STATS_SECT_ENTRY32(rx_dup)
+STATS_SECT_ENTRY32(rx_busy)
+STATS_SECT_ENTRY32(rsp_tx)
+STATS_SECT_ENTRY32(rsp_err)
+STATS_SECT_END;
+
+extern STATS_SECT_DECL(gl_coap_stats) gl_coap_stats;
+
+/** @brief Reply handler of a request sent with coap_utils_send_request().
+ *
+ * Runs in the OpenThread thread. @p response is NULL unless @p result is
+ * OT_ERROR_NONE.
+ */
+typedef void (*coap_utils_reply_cb_t)(otError result, otMessage *response);
+
+/** @brief Initialize the CoAP client on top of the OpenThread CoAP service
+ * and register the CoAP stats group.
+ */
+void coap_utils_init(void);
+
+/** @brief Send a non-confirmable request.
+ *
+ * The fast poll period is held until the reply arrives or
+ * COAP_REPLY_TIMEOUT ms pass.
+ *
+ * @param[in] code CoAP request code.
+ * @param[in] addr destination address, unicast or multicast.
+ * @param[in] port destination port.
+ * @param[in] uri_path URI path, segments separated by '/'.
+ * @param[in] payload payload or NULL.
+ * @param[in] payload_size payload size.
+ * @param[in] reply_cb reply handler, or NULL to not wait for a reply.
+ *
+ * @return 0 on success, COAP_UTILS_UNTRACKED if the request was sent but
+ *         @p reply_cb will not be called, negative errno otherwise.
+ */
+int coap_utils_send_request(otCoapCode code, const otIp6Address *addr, uint16_t port,
+			    const char *uri_path, const uint8_t *payload, uint16_t payload_size,
+			    coap_utils_reply_cb_t reply_cb);
+
+/** @brief Send a non-confirmable request with a Content-Format option.
+ *
+ * Same as coap_utils_send_request(), @p format tells the peer how the
+ * payload is encoded.
+ *
+ * @return 0 on success, COAP_UTILS_UNTRACKED if the request was sent but
+ *         @p reply_cb will not be called, negative errno otherwise.
+ */
+int coap_utils_send_request_format(otCoapCode code, const otIp6Address *addr, uint16_t port,
+				   const char *uri_path, otCoapOptionContentFormat format,
+				   const uint8_t *payload, uint16_t payload_size,
+				   coap_utils_reply_cb_t reply_cb);
 
 #endif /* _GL_COAP_UTILS_H_ */
\ No newline at end of file
@@ -0,0 +1,233 @@
+/*****************************************************************************
+ * @file  gl_dnssd.c
+ * @brief Backend server discovery through DNS-SD.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/dns_client.h>
+
+#include "gl_dnssd.h"
+
+#ifdef CONFIG_GL_DNSSD_DISCOVERY
+
+LOG_MODULE_REGISTER(gl_dnssd, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+struct dnssd_server {
+	otIp6Address addr;
+	uint16_t port;
+	uint16_t priority;
+	int64_t expire_at;
+	bool failed;
+};
+
+/* Servers learned from DNS-SD, valid until their record TTL expires */
+static struct dnssd_server servers[CONFIG_GL_DNSSD_MAX_SERVERS];
+static dnssd_server_cb_t server_cb;
+static bool query_pending;
+
+static bool dnssd_server_usable(const struct dnssd_server *server, int64_t now)
+{
+	return server->expire_at > now && !server->failed;
+}
+
+static struct dnssd_server *dnssd_best_server(void)
+{
+	struct dnssd_server *best = NULL;
+	int64_t now = k_uptime_get();
+
+	for (size_t i = 0; i < ARRAY_SIZE(servers); i++) {
+		if (!dnssd_server_usable(&servers[i], now)) {
+			continue;
+		}
+
+		if (best == NULL || servers[i].priority < best->priority) {
+			best = &servers[i];
+		}
+	}
+
+	return best;
+}
+
+static void dnssd_server_add(const otDnsServiceInfo *info)
+{
+	struct dnssd_server *slot = NULL;
+	uint32_t ttl = MIN(info->mTtl, info->mHostAddressTtl);
+	int64_t now = k_uptime_get();
+
+	if (ttl == 0 || otIp6IsAddressUnspecified(&info->mHostAddress)) {
+		return;
+	}
+
+	/* Refresh a known server, else take a free slot or the one expiring first */
+	for (size_t i = 0; i < ARRAY_SIZE(servers); i++) {
+		if (otIp6IsAddressEqual(&servers[i].addr, &info->mHostAddress)) {
+			slot = &servers[i];
+			break;
+		}
+
+		if (slot == NULL || servers[i].expire_at < slot->expire_at) {
+			slot = &servers[i];
+		}
+	}
+
+	slot->addr = info->mHostAddress;
+	slot->port = info->mPort;
+	slot->priority = info->mPriority;
+	slot->expire_at = now + (int64_t)ttl * MSEC_PER_SEC;
+	slot->failed = false;
+}
+
+static void dnssd_finish(void)
+{
+	struct dnssd_server *server = dnssd_best_server();
+	dnssd_server_cb_t cb = server_cb;
+	char addr_str[OT_IP6_ADDRESS_STRING_SIZE];
+
+	query_pending = false;
+	server_cb = NULL;
+
+	if (cb == NULL) {
+		return;
+	}
+
+	if (server == NULL) {
+		LOG_WRN("No %s server discovered", CONFIG_GL_DNSSD_SERVICE);
+		cb(NULL, 0);
+		return;
+	}
+
+	otIp6AddressToString(&server->addr, addr_str, sizeof(addr_str));
+	LOG_INF("Discovered server [%s]:%d", addr_str, server->port);
+
+	cb(&server->addr, server->port);
+}
+
+static void on_service_resolved(otError error, const otDnsServiceResponse *response,
+				void *context)
+{
+	otDnsServiceInfo info;
+
+	ARG_UNUSED(context);
+
+	if (error == OT_ERROR_NONE) {
+		memset(&info, 0, sizeof(info));
+		if (otDnsServiceResponseGetServiceInfo(response, &info) == OT_ERROR_NONE) {
+			dnssd_server_add(&info);
+		}
+	} else {
+		LOG_WRN("DNS-SD resolve failed: %d", error);
+	}
+
+	dnssd_finish();
+}
+
+static void on_service_browsed(otError error, const otDnsBrowseResponse *response,
+			       void *context)
+{
+	char label[OT_DNS_MAX_LABEL_SIZE];
+	char unresolved[OT_DNS_MAX_LABEL_SIZE] = { 0 };
+	otDnsServiceInfo info;
+
+	ARG_UNUSED(context);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_WRN("DNS-SD browse failed: %d", error);
+		dnssd_finish();
+		return;
+	}
+
+	for (uint16_t i = 0; otDnsBrowseResponseGetServiceInstance(response, i, label,
+								    sizeof(label)) == OT_ERROR_NONE;
+	     i++) {
+		memset(&info, 0, sizeof(info));
+		if (otDnsBrowseResponseGetServiceInfo(response, label, &info) == OT_ERROR_NONE &&
+		    info.mHostAddressTtl > 0) {
+			dnssd_server_add(&info);
+		} else if (unresolved[0] == '\0') {
+			strncpy(unresolved, label, sizeof(unresolved) - 1);
+		}
+	}
+
+	/* The address was not in the additional records, resolve the instance */
+	if (dnssd_best_server() == NULL && unresolved[0] != '\0' &&
+	    otDnsClientResolveService(openthread_get_default_instance(), unresolved,
+				      CONFIG_GL_DNSSD_SERVICE, on_service_resolved, NULL,
+				      NULL) == OT_ERROR_NONE) {
+		return;
+	}
+
+	dnssd_finish();
+}
+
+int dnssd_server_discover(dnssd_server_cb_t cb)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	struct dnssd_server *server;
+	struct dnssd_server cached;
+	otError error = OT_ERROR_NONE;
+
+	openthread_api_mutex_lock(context);
+
+	server = dnssd_best_server();
+	if (server != NULL) {
+		cached = *server;
+		openthread_api_mutex_unlock(context);
+		cb(&cached.addr, cached.port);
+		return 0;
+	}
+
+	if (!query_pending) {
+		error = otDnsClientBrowse(context->instance, CONFIG_GL_DNSSD_SERVICE,
+					  on_service_browsed, NULL, NULL);
+	}
+
+	if (error == OT_ERROR_NONE) {
+		query_pending = true;
+		server_cb = cb;
+	}
+
+	openthread_api_mutex_unlock(context);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("DNS-SD browse could not start: %d", error);
+		return -EIO;
+	}
+
+	LOG_INF("Browsing %s", CONFIG_GL_DNSSD_SERVICE);
+
+	return 0;
+}
+
+void dnssd_server_failed(const otIp6Address *addr)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(context);
+
+	for (size_t i = 0; i < ARRAY_SIZE(servers); i++) {
+		if (otIp6IsAddressEqual(&servers[i].addr, addr)) {
+			servers[i].failed = true;
+		}
+	}
+
+	openthread_api_mutex_unlock(context);
+}
+
+#endif /* CONFIG_GL_DNSSD_DISCOVERY */
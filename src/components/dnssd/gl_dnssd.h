@@ -0,0 +1,54 @@
+/*****************************************************************************
+ * @file  gl_dnssd.h
+ * @brief The header file of gl_dnssd.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_DNSSD_H_
+#define _GL_DNSSD_H_
+
+#include <openthread/ip6.h>
+
+/** @brief Type indicates function called when server discovery finishes.
+ *
+ * @param[in] addr server address, NULL if no server could be discovered.
+ * @param[in] port server UDP port.
+ */
+typedef void (*dnssd_server_cb_t)(const otIp6Address *addr, uint16_t port);
+
+/** @brief Look up a backend server advertised through DNS-SD.
+ *
+ * A cached server whose TTL has not expired is returned right away,
+ * otherwise the CONFIG_GL_DNSSD_SERVICE service is browsed and resolved
+ * through the OpenThread DNS client. The callback may run in the OpenThread
+ * thread context.
+ *
+ * @param[in] cb called with the selected server.
+ *
+ * @return 0 if the callback has been or will be called, negative error code
+ *         if the DNS query could not be started.
+ */
+int dnssd_server_discover(dnssd_server_cb_t cb);
+
+/** @brief Mark a discovered server as not responding.
+ *
+ * The server is skipped by later lookups until it is advertised again.
+ *
+ * @param[in] addr server address.
+ */
+void dnssd_server_failed(const otIp6Address *addr);
+
+#endif /* _GL_DNSSD_H_ */
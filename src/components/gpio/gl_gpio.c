@@ -27,6 +27,7 @@
 #include <zephyr/logging/log.h>
 
 #include "gl_gpio.h"
+#include "gl_lookup.h"
 
 #define GPIOS_NODE DT_PATH(glios)
 #define GPIO_SPEC_AND_COMMA(glios) GPIO_DT_SPEC_GET(glios, gpios),
@@ -41,7 +42,7 @@ LOG_MODULE_REGISTER(gl_gpio, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
 
 struct gpio_node {
 	gl_gpio_node_e      id;
-	char                name[16];
+	const char          *name;
     gl_gpio_status_e    status;
 } gl_gpio_obj[] = {
 	{ GPIO_015, "0.15", GPIO_LOW },
@@ -52,15 +53,9 @@ struct gpio_node {
 
 static gl_gpio_node_e _get_gpio_id_by_name(char* name)
 {
-    for(size_t i = 0; i < ARRAY_SIZE(gl_gpio_obj); i++)
-    {
-        if(0 == strcmp(gl_gpio_obj[i].name, name))
-        {
-            return gl_gpio_obj[i].id;
-        }
-    }
+    int id = gl_lookup_find(&gl_lookup_gpio, name);
 
-    return GPIO_NULL;
+    return id == GL_LOOKUP_NONE ? GPIO_NULL : id;
 }
 
 int gl_gpio_init(void)
@@ -98,7 +93,7 @@ gl_gpio_status_e gl_get_gpio_status(gl_gpio_node_e node)
     return gl_gpio_obj[node].status;
 }
 
-char* gl_get_gpio_name(gl_gpio_node_e node)
+const char* gl_get_gpio_name(gl_gpio_node_e node)
 {
     return gl_gpio_obj[node].name;
 }
@@ -37,7 +37,7 @@ int gl_gpio_init(void);
 
 gl_gpio_status_e gl_get_gpio_status(gl_gpio_node_e node);
 
-char* gl_get_gpio_name(gl_gpio_node_e node);
+const char* gl_get_gpio_name(gl_gpio_node_e node);
 
 int gl_set_gpio_status_by_id(gl_gpio_node_e node_id, gl_gpio_status_e status);
 
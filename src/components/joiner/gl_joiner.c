@@ -0,0 +1,156 @@
+/*****************************************************************************
+ * @file  gl_joiner.c
+ * @brief Joiner retry scheduler with randomized exponential backoff.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/settings/settings.h>
+#include <openthread/thread.h>
+
+#include "gl_joiner.h"
+#include "gl_ot_api.h"
+#include "gl_workq.h"
+
+LOG_MODULE_REGISTER(gl_joiner, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+#define JOINER_SETTINGS_ROOT "gl/joiner"
+#define JOINER_SETTINGS_ATTEMPTS JOINER_SETTINGS_ROOT "/attempts"
+
+/* Failed attempts since the last successful join, kept across reboots */
+static uint16_t attempts;
+static struct k_work_delayable joiner_retry_work;
+
+static int joiner_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+			       void *cb_arg)
+{
+	const char *next;
+	int rc;
+
+	if (settings_name_steq(key, "attempts", &next) && !next) {
+		if (len != sizeof(attempts)) {
+			return -EINVAL;
+		}
+
+		rc = read_cb(cb_arg, &attempts, sizeof(attempts));
+		return rc < 0 ? rc : 0;
+	}
+
+	return -ENOENT;
+}
+
+static struct settings_handler joiner_settings = {
+	.name = JOINER_SETTINGS_ROOT,
+	.h_set = joiner_settings_set,
+};
+
+static void joiner_attempts_store(uint16_t value)
+{
+	attempts = value;
+
+	if (settings_save_one(JOINER_SETTINGS_ATTEMPTS, &attempts, sizeof(attempts))) {
+		LOG_WRN("Failed to store joiner attempts");
+	}
+}
+
+static uint32_t joiner_backoff_ms(uint16_t attempt)
+{
+	uint32_t window = CONFIG_GL_JOINER_BACKOFF_MAX;
+
+	if (attempt < 16 && (CONFIG_GL_JOINER_BACKOFF_MIN << attempt) < window) {
+		window = CONFIG_GL_JOINER_BACKOFF_MIN << attempt;
+	}
+
+	/* Equal jitter: half of the window is fixed, the other half random */
+	return window / 2 + sys_rand32_get() % (window / 2 + 1);
+}
+
+static void joiner_retry(struct k_work *item)
+{
+	otError err;
+
+	ARG_UNUSED(item);
+
+	LOG_INF("Start joiner again... %d", attempts);
+
+	err = start_joiner();
+	if (err != OT_ERROR_NONE) {
+		LOG_ERR("Failed to start joiner, error: %d", err);
+	}
+}
+
+void joiner_sched_init(void)
+{
+	int err;
+
+	k_work_init_delayable(&joiner_retry_work, joiner_retry);
+
+	err = settings_subsys_init();
+	if (err) {
+		LOG_ERR("settings_subsys_init failed (err %d)", err);
+		return;
+	}
+
+	settings_register(&joiner_settings);
+	settings_load_subtree(JOINER_SETTINGS_ROOT);
+
+	if (attempts) {
+		LOG_INF("Resuming joiner backoff after %d failed attempts", attempts);
+	}
+}
+
+void joiner_sched_session_start(bool reset_budget)
+{
+	k_work_cancel_delayable(&joiner_retry_work);
+
+	if (reset_budget && attempts) {
+		joiner_attempts_store(0);
+	}
+}
+
+bool joiner_sched_retry(void)
+{
+	uint32_t delay;
+
+	if (attempts >= CONFIG_GL_JOINER_RETRY_BUDGET) {
+		/* Keep trying slowly, the count is no longer written to flash */
+		delay = CONFIG_GL_JOINER_SLOW_INTERVAL / 2 +
+			sys_rand32_get() % (CONFIG_GL_JOINER_SLOW_INTERVAL / 2 + 1);
+
+		LOG_WRN("Joiner retry budget exhausted, next attempt in %dms", delay);
+		k_work_reschedule_for_queue(&gl_workq_lo, &joiner_retry_work, K_MSEC(delay));
+		return false;
+	}
+
+	delay = joiner_backoff_ms(attempts);
+	joiner_attempts_store(attempts + 1);
+
+	LOG_INF("Joiner retry %d/%d in %dms", attempts, CONFIG_GL_JOINER_RETRY_BUDGET, delay);
+	k_work_reschedule_for_queue(&gl_workq_lo, &joiner_retry_work, K_MSEC(delay));
+
+	return true;
+}
+
+void joiner_sched_joined(void)
+{
+	k_work_cancel_delayable(&joiner_retry_work);
+
+	if (attempts) {
+		joiner_attempts_store(0);
+	}
+}
@@ -0,0 +1,52 @@
+/*****************************************************************************
+ * @file  gl_joiner.h
+ * @brief The header file of gl_joiner.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_JOINER_H_
+#define _GL_JOINER_H_
+
+#include <zephyr/types.h>
+
+/** @brief Initialize the joiner scheduler and load the persisted retry count.
+ */
+void joiner_sched_init(void);
+
+/** @brief Begin a joining session.
+ *
+ * @param[in] reset_budget true to grant a fresh retry budget (user request),
+ *                         false to continue with the budget left over from
+ *                         previous boots.
+ */
+void joiner_sched_session_start(bool reset_budget);
+
+/** @brief Schedule the next joiner attempt after a failed one.
+ *
+ * The delay grows exponentially from CONFIG_GL_JOINER_BACKOFF_MIN up to
+ * CONFIG_GL_JOINER_BACKOFF_MAX with random jitter. Once the retry budget is
+ * used up the attempts go on about every CONFIG_GL_JOINER_SLOW_INTERVAL.
+ *
+ * @return true if a retry within the budget has been scheduled, false once
+ *         the budget is used up and only slow retries are left.
+ */
+bool joiner_sched_retry(void);
+
+/** @brief Report a successful join, clearing the persisted retry count.
+ */
+void joiner_sched_joined(void);
+
+#endif /* _GL_JOINER_H_ */
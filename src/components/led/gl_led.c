@@ -22,80 +22,258 @@
 #include <zephyr/devicetree.h>
 #include <zephyr/device.h>
 #include <dk_buttons_and_leds.h>
+#include <zephyr/spinlock.h>
 
 #include "gl_led.h"
 
-static struct k_timer led_timer;
-static bool led_timer_start;
+/* Blinks waiting to play over the base pattern of one LED */
+#define LED_BLINK_QUEUE_LEN 4
+
+/* Software PWM frame used to dim the LED while breathing */
+#define LED_PWM_FRAME_MS 10
+
+#define LED_TOGGLE_DELAY_MS 100
+#define LIGHT_BLINK_PERIOD 200
+
+struct led_blink {
+	uint16_t period_ms;
+	uint8_t count;
+};
+
+struct led_channel {
+	struct k_timer timer;
+	uint8_t led;
+	bool level;
+
+	/* Pattern shown whenever no blink is queued */
+	enum led_pattern base;
+	uint16_t base_period_ms;
+	uint32_t base_started;
+
+	struct led_blink queue[LED_BLINK_QUEUE_LEN];
+	uint8_t q_head;
+	uint8_t q_len;
+	bool blink_idle;
+
+	uint32_t step;
+	uint8_t duty;
+};
+
+static struct led_channel channels[] = {
+	{ .led = LED1 },
+	{ .led = LED2 },
+};
+static struct k_spinlock led_lock;
 static int light_state;
 
+static struct led_channel *led_channel_get(uint8_t led_idx)
+{
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		if (channels[i].led == led_idx) {
+			return &channels[i];
+		}
+	}
+
+	return NULL;
+}
+
+static void led_channel_level(struct led_channel *ch, bool level)
+{
+	ch->level = level;
+	dk_set_led(ch->led, level);
+}
+
+/* Brightness of a breathing LED in ms of on time per PWM frame */
+static uint8_t led_breathe_duty(struct led_channel *ch)
+{
+	uint32_t half = MAX(ch->base_period_ms / 2, 1);
+	uint32_t phase = (k_uptime_get_32() - ch->base_started) % (half * 2);
+	uint32_t ramp = phase < half ? phase : half * 2 - phase;
+
+	return ramp * LED_PWM_FRAME_MS / half;
+}
+
+/* Returns the time until the next step, or 0 when the LED stays as it is */
+static uint32_t led_base_step(struct led_channel *ch)
+{
+	switch (ch->base) {
+	case LED_PATTERN_TOGGLE:
+		led_channel_level(ch, !ch->level);
+		return MAX(ch->base_period_ms / 2, 1);
+	case LED_PATTERN_BREATHE:
+		if (ch->step++ % 2) {
+			led_channel_level(ch, false);
+			return LED_PWM_FRAME_MS - ch->duty;
+		}
+
+		ch->duty = led_breathe_duty(ch);
+		if (ch->duty == 0 || ch->duty == LED_PWM_FRAME_MS) {
+			/* Nothing to switch off within this frame */
+			ch->step++;
+			led_channel_level(ch, ch->duty != 0);
+			return LED_PWM_FRAME_MS;
+		}
+
+		led_channel_level(ch, true);
+		return ch->duty;
+	case LED_PATTERN_ON:
+		led_channel_level(ch, true);
+		return 0;
+	case LED_PATTERN_OFF:
+	default:
+		led_channel_level(ch, false);
+		return 0;
+	}
+}
+
+static uint32_t led_blink_step(struct led_channel *ch)
+{
+	struct led_blink *blink;
+
+	while (ch->q_len) {
+		blink = &ch->queue[ch->q_head];
+
+		if (ch->step < blink->count * 2U) {
+			/* Flash against the level the LED had when the blink started */
+			led_channel_level(ch, ch->step++ % 2 ? ch->blink_idle : !ch->blink_idle);
+			return MAX(blink->period_ms / 2, 1);
+		}
+
+		ch->q_head = (ch->q_head + 1) % LED_BLINK_QUEUE_LEN;
+		ch->q_len--;
+		ch->step = 0;
+		ch->blink_idle = ch->level;
+	}
+
+	return led_base_step(ch);
+}
+
+/* Called with led_lock held, from the timer expiry or a setter */
+static void led_channel_run(struct led_channel *ch)
+{
+	uint32_t next_ms = led_blink_step(ch);
+
+	if (next_ms) {
+		k_timer_start(&ch->timer, K_MSEC(next_ms), K_NO_WAIT);
+	} else {
+		k_timer_stop(&ch->timer);
+	}
+}
 
 static void on_led_timer_expiry(struct k_timer *timer_id)
 {
-	static uint32_t val = 1;
+	struct led_channel *ch = CONTAINER_OF(timer_id, struct led_channel, timer);
+	k_spinlock_key_t key = k_spin_lock(&led_lock);
 
-	ARG_UNUSED(timer_id);
+	led_channel_run(ch);
 
-	dk_set_led((uint8_t)LED2, val);
-	val = !val;
+	k_spin_unlock(&led_lock, key);
 }
 
-static void on_led_timer_stop(struct k_timer *timer_id)
+void gl_led_init(void)
 {
-	ARG_UNUSED(timer_id);
+	for (size_t i = 0; i < ARRAY_SIZE(channels); i++) {
+		k_timer_init(&channels[i].timer, on_led_timer_expiry, NULL);
+	}
+}
+
+void led_pattern_set(uint8_t led_idx, enum led_pattern pattern, uint16_t period_ms)
+{
+	struct led_channel *ch = led_channel_get(led_idx);
+	k_spinlock_key_t key;
+
+	if (ch == NULL) {
+		return;
+	}
+
+	key = k_spin_lock(&led_lock);
+
+	ch->base = pattern;
+	ch->base_period_ms = period_ms;
+	ch->base_started = k_uptime_get_32();
 
-	dk_set_led((uint8_t)LED2, (uint32_t)LED_OFF);
+	/* A running blink restores the new base pattern when it is done */
+	if (!ch->q_len) {
+		ch->step = 0;
+		if (pattern == LED_PATTERN_TOGGLE) {
+			led_channel_level(ch, false);
+			k_timer_start(&ch->timer, K_MSEC(LED_TOGGLE_DELAY_MS), K_NO_WAIT);
+		} else {
+			led_channel_run(ch);
+		}
+	}
+
+	k_spin_unlock(&led_lock, key);
 }
 
-void led_toggle_start(int ms)
+int led_blink(uint8_t led_idx, uint16_t period_ms, uint8_t count)
 {
-	k_timer_stop(&led_timer);
+	struct led_channel *ch = led_channel_get(led_idx);
+	k_spinlock_key_t key;
+	int ret = 0;
+
+	if (ch == NULL || count == 0) {
+		return -EINVAL;
+	}
+
+	key = k_spin_lock(&led_lock);
 
-	led_timer_start = true;
+	if (ch->q_len == LED_BLINK_QUEUE_LEN) {
+		ret = -ENOMEM;
+	} else {
+		ch->queue[(ch->q_head + ch->q_len) % LED_BLINK_QUEUE_LEN] = (struct led_blink){
+			.period_ms = period_ms,
+			.count = count,
+		};
 
-	k_timer_init(&led_timer, on_led_timer_expiry, on_led_timer_stop);
-	k_timer_start(&led_timer, K_MSEC(100), K_MSEC(ms));
+		if (ch->q_len++ == 0) {
+			ch->step = 0;
+			ch->blink_idle = ch->level;
+			led_channel_run(ch);
+		}
+	}
+
+	k_spin_unlock(&led_lock, key);
+
+	return ret;
 }
 
-void led_toggle_stop(void)
+void led_toggle_start(int ms)
 {
-	k_timer_stop(&led_timer);
+	led_pattern_set(LED2, LED_PATTERN_TOGGLE, ms * 2);
+}
 
-	led_timer_start = false;
+void led_toggle_stop(void)
+{
+	led_pattern_set(LED2, LED_PATTERN_OFF, 0);
 }
 
 void led_on(uint8_t led_idx)
 {
-	if (led_timer_start)
-		led_toggle_stop();
-
-	dk_set_led_on(led_idx);
+	led_pattern_set(led_idx, LED_PATTERN_ON, 0);
 }
 
 void led_off(uint8_t led_idx)
 {
-	if (led_timer_start)
-		led_toggle_stop();
-
-	dk_set_led_off(led_idx);
+	led_pattern_set(led_idx, LED_PATTERN_OFF, 0);
 }
 
 void light_on(void)
 {
-	dk_set_led_on(LED1);
+	led_on(LED1);
 	light_state = 1;
 }
 
 void light_off(void)
 {
-	dk_set_led_off(LED1);
-	dk_set_led_off(LED2);
+	led_off(LED1);
+	led_off(LED2);
 	light_state = 0;
 }
 
 void light_set_state(int val)
 {
-	dk_set_led(LED1, val);
+	led_pattern_set(LED1, val ? LED_PATTERN_ON : LED_PATTERN_OFF, 0);
 	light_state = val;
 }
 
@@ -112,9 +290,6 @@ void light_toggle_onoff(void)
 
 void light_onoff(void)
 {
-	light_set_state(0);
-	k_sleep(K_MSEC(100));
-	light_set_state(1);
-	k_sleep(K_MSEC(100));
-	light_set_state(0);
+	/* Feedback only, the blink is dropped if too many are already queued */
+	led_blink(LED1, LIGHT_BLINK_PERIOD, 1);
 }
\ No newline at end of file
@@ -20,6 +20,8 @@
 #ifndef _GL_LED_H_
 #define _GL_LED_H_
 
+#include <zephyr/types.h>
+
 /**
  * @brief OnOff Light
  * Control by Button1
@@ -44,6 +46,43 @@ enum{
 #define BUTTON_S1
 #define BUTTON_S2
 
+/**
+ * @brief Base pattern of a LED, shown whenever no blink is queued
+ */
+enum led_pattern {
+	LED_PATTERN_OFF,
+	LED_PATTERN_ON,
+	LED_PATTERN_TOGGLE,
+	LED_PATTERN_BREATHE
+};
+
+/** @brief Initialize the LED pattern timers.
+ */
+void gl_led_init(void);
+
+/** @brief Set the base pattern of a LED.
+ *
+ * Patterns are driven from timers, the call never blocks.
+ *
+ * @param[in] led_idx LED1 or LED2.
+ * @param[in] pattern base pattern.
+ * @param[in] period_ms full cycle of LED_PATTERN_TOGGLE and LED_PATTERN_BREATHE.
+ */
+void led_pattern_set(uint8_t led_idx, enum led_pattern pattern, uint16_t period_ms);
+
+/** @brief Queue a blink over the base pattern of a LED.
+ *
+ * The LED flashes against its current level @p count times, then the base
+ * pattern resumes.
+ *
+ * @param[in] led_idx LED1 or LED2.
+ * @param[in] period_ms duration of one flash including the pause.
+ * @param[in] count number of flashes.
+ *
+ * @return 0 on success, -ENOMEM if too many blinks are queued.
+ */
+int led_blink(uint8_t led_idx, uint16_t period_ms, uint8_t count);
+
 void led_toggle_start(int ms);
 void led_toggle_stop(void);
 void led_on(uint8_t led_idx);
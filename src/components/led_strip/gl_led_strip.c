@@ -26,6 +26,7 @@
 #include <string.h>
 
 #include "gl_led_strip.h"
+#include "gl_workq.h"
 
 #define STRIP_NODE DT_ALIAS(led_strip)
 #define STRIP_NUM_PIXELS DT_PROP(DT_ALIAS(led_strip), chain_length)
@@ -60,6 +61,19 @@ static uint16_t delay_node;
 static int delay_on_off;
 static struct k_work delay_work;
 
+/* Guards the strip state, writers from other threads wait while it is held */
+static K_MUTEX_DEFINE(strip_lock);
+
+/* Changes of the thread that opened a group are staged here and only the
+ * nodes it touched are applied on commit, so writers from other threads are
+ * neither deferred nor reverted by the group.
+ */
+static k_tid_t group_owner;
+static uint32_t group_touched;
+static bool group_on_off[STRIP_NUM_PIXELS];
+static struct led_rgb group_pixels[STRIP_NUM_PIXELS];
+
+BUILD_ASSERT(STRIP_NUM_PIXELS <= 32, "group_touched holds one bit per node");
 
 static int led_update_rgb(void);
 
@@ -97,6 +111,39 @@ int gl_led_strip_init(void)
 	return 0;
 }
 
+static bool in_group(void)
+{
+	return group_owner != NULL && group_owner == k_current_get();
+}
+
+static bool *state_on_off(void)
+{
+	return in_group() ? group_on_off : strip_on_off;
+}
+
+static struct led_rgb *state_pixels(void)
+{
+	return in_group() ? group_pixels : pixels;
+}
+
+/* Pushes the state to the strip, or only records the touched nodes when the
+ * caller has a group open. Called with strip_lock held.
+ */
+static int led_state_changed(uint32_t nodes)
+{
+	if (in_group()) {
+		group_touched |= nodes;
+		return 0;
+	}
+
+	return led_update_rgb();
+}
+
+static uint32_t node_mask(uint16_t node)
+{
+	return node == ALL_LED_NODE ? BIT_MASK(STRIP_NUM_PIXELS) : BIT(node - 1);
+}
+
 static int led_update_rgb(void)
 {
 	for(int i = 0; i < STRIP_NUM_PIXELS; i++)
@@ -132,13 +179,69 @@ static int led_update_rgb(void)
 	return 0;
 }
 
+void led_strip_group_begin(void)
+{
+	k_mutex_lock(&strip_lock, K_FOREVER);
+	memcpy(group_on_off, strip_on_off, sizeof(group_on_off));
+	memcpy(group_pixels, pixels, sizeof(group_pixels));
+	group_touched = 0;
+	group_owner = k_current_get();
+	k_mutex_unlock(&strip_lock);
+}
+
+int led_strip_group_commit(void)
+{
+	int rc = 0;
+
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	if (!in_group()) {
+		goto end;
+	}
+
+	group_owner = NULL;
+
+	for (int i = 0; i < STRIP_NUM_PIXELS; i++) {
+		if (group_touched & BIT(i)) {
+			strip_on_off[i] = group_on_off[i];
+			memcpy(&pixels[i], &group_pixels[i], sizeof(struct led_rgb));
+		}
+	}
+
+	if (group_touched) {
+		rc = led_update_rgb();
+	}
+
+end:
+	k_mutex_unlock(&strip_lock);
+
+	return rc;
+}
+
+void led_strip_group_abort(void)
+{
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	/* Nothing of the group reached the live state, drop what was staged */
+	if (in_group()) {
+		group_owner = NULL;
+	}
+
+	k_mutex_unlock(&strip_lock);
+}
+
 int update_led_strip_rgb_to_next(void)
 {
 	static int count = 0;
+	struct led_rgb *px;
+	int rc;
+
+	k_mutex_lock(&strip_lock, K_FOREVER);
 
+	px = state_pixels();
 	for(int i = 0; i < STRIP_NUM_PIXELS; i++)
 	{
-		memcpy(&pixels[i], &def_colors[count], sizeof(struct led_rgb));
+		memcpy(&px[i], &def_colors[count], sizeof(struct led_rgb));
 	}
 
 	count++;
@@ -147,7 +250,10 @@ int update_led_strip_rgb_to_next(void)
 		count = 0;
 	}
 
-	return led_update_rgb();
+	rc = led_state_changed(node_mask(ALL_LED_NODE));
+	k_mutex_unlock(&strip_lock);
+
+	return rc;
 }
 
 int update_led_strip_rgb(uint16_t node, struct led_rgb* color)
@@ -159,20 +265,32 @@ int update_led_strip_rgb(uint16_t node, struct led_rgb* color)
 
 	printk("node: %d \nr: %d g: %d b: %d\n", node, color->r, color->g, color->b);
 
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	struct led_rgb *px = state_pixels();
+	int rc;
+
 	if(node == ALL_LED_NODE)
 	{
 		for(int i = 0; i < STRIP_NUM_PIXELS; i++)
 		{
-			memcpy(&pixels[i], color, sizeof(struct led_rgb));
+			memcpy(&px[i], color, sizeof(struct led_rgb));
 		}
 	} else {
-		memcpy(&pixels[(node - 1)], color, sizeof(struct led_rgb));
-		if (false == strip_on_off[(node - 1)]) {
+		memcpy(&px[(node - 1)], color, sizeof(struct led_rgb));
+		if (false == state_on_off()[(node - 1)]) {
+			if (in_group()) {
+				group_touched |= node_mask(node);
+			}
+			k_mutex_unlock(&strip_lock);
 			return -3;
 		}
 	}
 
-	return led_update_rgb();
+	rc = led_state_changed(node_mask(node));
+	k_mutex_unlock(&strip_lock);
+
+	return rc;
 }
 
 int on_off_led_strip(uint16_t node, int on_off)
@@ -190,27 +308,35 @@ int on_off_led_strip(uint16_t node, int on_off)
 		led_status = false;
 	}
 
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	bool *on = state_on_off();
+	int rc;
+
 	if(node == ALL_LED_NODE)
 	{
 		for(int i = 0; i < STRIP_NUM_PIXELS; i++)
 		{
 			if(on_off == LED_TOGGLE)
 			{
-				led_status = !strip_on_off[i];
+				led_status = !on[i];
 			}
 
-			strip_on_off[i] = led_status;
+			on[i] = led_status;
 		}	
 	} else {
 		if(on_off == LED_TOGGLE)
 		{
-			led_status = !strip_on_off[(node - 1)];
+			led_status = !on[(node - 1)];
 		}
 
-		strip_on_off[(node - 1)] = led_status;
+		on[(node - 1)] = led_status;
 	}
 
-	return led_update_rgb();
+	rc = led_state_changed(node_mask(node));
+	k_mutex_unlock(&strip_lock);
+
+	return rc;
 }
 
 int on_off_led_strip_with_delay(uint16_t node, int on_off, uint16_t delay_ms)
@@ -242,7 +368,7 @@ static void led_delay_timer_expiry(struct k_timer *timer_id)
 {
 	ARG_UNUSED(timer_id);
 
-	k_work_submit(&delay_work);
+	k_work_submit_to_queue(&gl_workq_hi, &delay_work);
 }
 
 static void led_delay_work(struct k_work *item)
@@ -259,14 +385,18 @@ int get_led_strip_status(uint16_t node, int* on_off, struct led_rgb* color)
 		return -1;
 	}
 
-	if(strip_on_off[(node - 1)] == true)
+	k_mutex_lock(&strip_lock, K_FOREVER);
+
+	if(state_on_off()[(node - 1)] == true)
 	{
 		*on_off = 1;
 	}else{
 		*on_off = 0;
 	}
 
-	memcpy(color, &pixels[(node - 1)], sizeof(struct led_rgb));
+	memcpy(color, &state_pixels()[(node - 1)], sizeof(struct led_rgb));
+
+	k_mutex_unlock(&strip_lock);
 
 	return 0;
 }
@@ -45,6 +45,15 @@ int on_off_led_strip_with_delay(uint16_t node, int on_off, uint16_t delay_ms);
 
 int get_led_strip_status(uint16_t node, int* on_off, struct led_rgb* color);
 
+/* Group several changes of the calling thread into one strip refresh. They
+ * are staged after begin and pushed together by commit, or dropped by abort.
+ * Changes from other threads still reach the strip at once, and commit only
+ * applies the nodes the group touched.
+ */
+void led_strip_group_begin(void);
+int led_strip_group_commit(void);
+void led_strip_group_abort(void);
+
 void test_led_strip_1(void);
 void test_led_strip_2(void);
 
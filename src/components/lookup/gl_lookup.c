@@ -0,0 +1,56 @@
+/*****************************************************************************
+ * @file  gl_lookup.c
+ * @brief Constant time string to id lookup in generated perfect hash tables.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+
+#include "gl_lookup.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+
+uint32_t gl_lookup_hash(uint32_t seed, const char *key)
+{
+	uint32_t hash = FNV_OFFSET_BASIS ^ seed;
+
+	while (*key) {
+		hash ^= (uint8_t)*key++;
+		hash *= FNV_PRIME;
+	}
+
+	/* The low bits pick the slot, fold the better mixed high bits into them */
+	return hash ^ (hash >> 16);
+}
+
+int gl_lookup_find(const struct gl_lookup_table *table, const char *key)
+{
+	const struct gl_lookup_entry *entry;
+
+	if (key == NULL) {
+		return GL_LOOKUP_NONE;
+	}
+
+	/* One slot per key, a single compare tells a hit from a stranger */
+	entry = &table->entries[gl_lookup_hash(table->seed, key) & table->mask];
+	if (entry->key == NULL || strcmp(entry->key, key)) {
+		return GL_LOOKUP_NONE;
+	}
+
+	return entry->value;
+}
@@ -0,0 +1,68 @@
+/*****************************************************************************
+ * @file  gl_lookup.h
+ * @brief The header file of gl_lookup.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_LOOKUP_H_
+#define _GL_LOOKUP_H_
+
+#include <zephyr/types.h>
+
+/* Returned by gl_lookup_find() for unknown keys */
+#define GL_LOOKUP_NONE (-1)
+
+struct gl_lookup_entry {
+	const char *key;
+	int value;
+};
+
+/* Perfect hash table: every key hashes to its own slot, empty slots have a NULL key */
+struct gl_lookup_table {
+	const struct gl_lookup_entry *entries;
+	uint32_t seed;
+	uint32_t mask;
+};
+
+/* Generated at build time from gl_lookup.def by scripts/gen_lookup.py */
+extern const struct gl_lookup_table gl_lookup_cmd;
+extern const struct gl_lookup_table gl_lookup_led_obj;
+extern const struct gl_lookup_table gl_lookup_gpio;
+extern const struct gl_lookup_table gl_lookup_trigger;
+extern const struct gl_lookup_table gl_lookup_rule_src;
+extern const struct gl_lookup_table gl_lookup_rule_sensor;
+extern const struct gl_lookup_table gl_lookup_rule_op;
+extern const struct gl_lookup_table gl_lookup_rule_act;
+
+/** @brief Hash a key the way scripts/gen_lookup.py does.
+ *
+ * @param[in] seed seed of the table.
+ * @param[in] key NUL terminated key.
+ *
+ * @return 32 bit FNV-1a hash of the key, seeded and folded.
+ */
+uint32_t gl_lookup_hash(uint32_t seed, const char *key);
+
+/** @brief Look a key up in a generated table.
+ *
+ * @param[in] table table to search.
+ * @param[in] key key to find, may be NULL.
+ *
+ * @return value of the key, GL_LOOKUP_NONE if it is not in the table.
+ */
+int gl_lookup_find(const struct gl_lookup_table *table, const char *key);
+
+#endif /* _GL_LOOKUP_H_ */
@@ -24,6 +24,11 @@
 #include <zephyr/net/openthread.h>
 #include <openthread/thread.h>
 #include <openthread/joiner.h>
+#include <openthread/link.h>
+#include <openthread/platform/radio.h>
+#ifdef CONFIG_OPENTHREAD_FTD
+#include <openthread/thread_ftd.h>
+#endif
 #include <platform-zephyr.h>
 #include <zephyr/init.h>
 #include <zephyr/sys/util.h>
@@ -179,9 +184,12 @@ void ot_print_network_info(void)
 	otRouterInfo parentInfo;
 	otThreadGetParentInfo(instance, &parentInfo);
 
-	LOG_INF("txpower=%ddBm, networkname=%s, channel=%d, panid=0x%04x, eui64=%s, extaddr=%s, ipaddr=%s, parent.rloc16=0x%04x",
+	int8_t parentRssi = 0;
+	otThreadGetParentAverageRssi(instance, &parentRssi);
+
+	LOG_INF("txpower=%ddBm, networkname=%s, channel=%d, panid=0x%04x, eui64=%s, extaddr=%s, ipaddr=%s, parent.rloc16=0x%04x, parent.rssi=%ddBm",
 		ot_get_txpower(), otThreadGetNetworkName(instance), otLinkGetChannel(instance),
-		otLinkGetPanId(instance), eui64, extaddr, ipaddr, parentInfo.mRloc16);
+		otLinkGetPanId(instance), eui64, extaddr, ipaddr, parentInfo.mRloc16, parentRssi);
 }
 
 char *ot_get_mode(void)
@@ -219,6 +227,61 @@ int ot_get_txpower(void)
 	return power;
 }
 
+int ot_get_link_telemetry(struct ot_link_telemetry *telemetry)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	struct otInstance *instance = context->instance;
+	const otMacCounters *counters;
+	otNeighborInfoIterator iterator = OT_NEIGHBOR_INFO_ITERATOR_INIT;
+	otNeighborInfo neighbor;
+	otRouterInfo parent_info;
+
+	if (telemetry == NULL) {
+		return -EINVAL;
+	}
+
+	memset(telemetry, 0, sizeof(*telemetry));
+
+	openthread_api_mutex_lock(context);
+
+	if (otThreadGetDeviceRole(instance) == OT_DEVICE_ROLE_CHILD &&
+	    otThreadGetParentInfo(instance, &parent_info) == OT_ERROR_NONE) {
+		telemetry->has_parent = true;
+		telemetry->parent_rloc16 = parent_info.mRloc16;
+		telemetry->parent_lqi = parent_info.mLinkQualityIn;
+		otThreadGetParentLastRssi(instance, &telemetry->parent_rssi);
+		otThreadGetParentAverageRssi(instance, &telemetry->parent_avg_rssi);
+		telemetry->link_margin = telemetry->parent_avg_rssi -
+					 otPlatRadioGetReceiveSensitivity(instance);
+	}
+
+	while (otThreadGetNextNeighborInfo(instance, &iterator, &neighbor) == OT_ERROR_NONE) {
+		telemetry->neighbors++;
+		if (telemetry->has_parent && neighbor.mRloc16 == telemetry->parent_rloc16) {
+			telemetry->parent_frame_err_rate = neighbor.mFrameErrorRate;
+		}
+	}
+
+#ifdef CONFIG_OPENTHREAD_FTD
+	otChildInfo child_info;
+
+	for (uint16_t i = 0; i < otThreadGetMaxAllowedChildren(instance); i++) {
+		if (otThreadGetChildInfoByIndex(instance, i, &child_info) == OT_ERROR_NONE) {
+			telemetry->children++;
+		}
+	}
+#endif
+
+	counters = otLinkGetCounters(instance);
+	telemetry->tx_total = counters->mTxTotal;
+	telemetry->tx_retry = counters->mTxRetry;
+	telemetry->tx_err_cca = counters->mTxErrCca;
+
+	openthread_api_mutex_unlock(context);
+
+	return 0;
+}
+
 static void ot_joiner_start_handler(otError error, void *context)
 {
 	struct openthread_context *ot_context = context;
@@ -26,6 +26,24 @@ enum {
 	OT_SETTINGS_KEY_BASE_END = 0xffff
 };
 
+/* Link health snapshot. MAC counters are totals since boot, so the periodic
+ * report and observe notifications do not consume each other's deltas.
+ */
+struct ot_link_telemetry {
+	bool has_parent;
+	uint16_t parent_rloc16;
+	int8_t parent_rssi;
+	int8_t parent_avg_rssi;
+	int8_t link_margin;
+	uint8_t parent_lqi;
+	uint16_t parent_frame_err_rate;
+	uint32_t tx_total;
+	uint32_t tx_retry;
+	uint32_t tx_err_cca;
+	uint16_t neighbors;
+	uint16_t children;
+};
+
 char *ot_get_eui64(void);
 char *ot_get_extaddr(void);
 int ot_get_thread_version(void);
@@ -39,6 +57,7 @@ int ot_start(void);
 void ot_print_network_info(void);
 char *ot_get_mode(void);
 int ot_get_txpower(void);
+int ot_get_link_telemetry(struct ot_link_telemetry *telemetry);
 
 otError start_joiner(void);
 void auto_commissioning_timer_init(void);
@@ -0,0 +1,161 @@
+/*****************************************************************************
+ * @file  gl_persist.c
+ * @brief Runtime configuration kept in settings with coalesced writes.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "gl_persist.h"
+#include "gl_workq.h"
+
+#ifdef CONFIG_GL_PERSIST
+
+LOG_MODULE_REGISTER(gl_persist, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+#define PERSIST_SETTINGS_ROOT "gl/cfg"
+#define PERSIST_KEY_LEN 32
+
+struct persist_stored {
+	uint8_t data[PERSIST_MAX_LEN];
+	size_t len;
+};
+
+static const struct persist_item_ops *item_ops;
+/* Last written state of every item, only used from the low priority work
+ * queue once initialized.
+ */
+static struct persist_stored stored[PERSIST_ITEMS];
+static atomic_t dirty;
+static struct k_work_delayable save_work;
+
+static void persist_key(char *key, enum persist_item item)
+{
+	snprintk(key, PERSIST_KEY_LEN, PERSIST_SETTINGS_ROOT "/%s", item_ops[item].name);
+}
+
+static int persist_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+				void *cb_arg)
+{
+	const char *next;
+	int rc;
+
+	for (int i = 0; i < PERSIST_ITEMS; i++) {
+		if (!settings_name_steq(key, item_ops[i].name, &next) || next) {
+			continue;
+		}
+
+		if (len > PERSIST_MAX_LEN) {
+			return -EINVAL;
+		}
+
+		rc = read_cb(cb_arg, stored[i].data, len);
+		if (rc < 0) {
+			return rc;
+		}
+
+		stored[i].len = len;
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static struct settings_handler persist_settings = {
+	.name = PERSIST_SETTINGS_ROOT,
+	.h_set = persist_settings_set,
+};
+
+static void persist_save(struct k_work *item)
+{
+	atomic_val_t items = atomic_clear(&dirty);
+	char key[PERSIST_KEY_LEN];
+	uint8_t data[PERSIST_MAX_LEN];
+	size_t len;
+
+	ARG_UNUSED(item);
+
+	for (int i = 0; i < PERSIST_ITEMS; i++) {
+		if (!(items & BIT(i))) {
+			continue;
+		}
+
+		len = item_ops[i].get(data);
+		if (len == stored[i].len && !memcmp(data, stored[i].data, len)) {
+			continue;
+		}
+
+		persist_key(key, i);
+		if (settings_save_one(key, data, len)) {
+			LOG_WRN("Failed to store %s", item_ops[i].name);
+			continue;
+		}
+
+		memcpy(stored[i].data, data, len);
+		stored[i].len = len;
+		LOG_INF("Stored %s", item_ops[i].name);
+	}
+}
+
+void persist_init(const struct persist_item_ops *ops)
+{
+	item_ops = ops;
+	k_work_init_delayable(&save_work, persist_save);
+
+	settings_register(&persist_settings);
+	settings_load_subtree(PERSIST_SETTINGS_ROOT);
+
+	for (int i = 0; i < PERSIST_ITEMS; i++) {
+		if (stored[i].len) {
+			LOG_INF("Restoring %s", item_ops[i].name);
+			item_ops[i].set(stored[i].data, stored[i].len);
+		}
+	}
+}
+
+void persist_mark(enum persist_item item)
+{
+	atomic_set_bit(&dirty, item);
+
+	/* Not rescheduled: the first change starts the delay, later ones join it */
+	k_work_schedule_for_queue(&gl_workq_lo, &save_work,
+				  K_MSEC(CONFIG_GL_PERSIST_SAVE_DELAY));
+}
+
+void persist_flush(void)
+{
+	k_work_cancel_delayable(&save_work);
+	persist_save(NULL);
+}
+
+void persist_clear(void)
+{
+	char key[PERSIST_KEY_LEN];
+
+	k_work_cancel_delayable(&save_work);
+	atomic_clear(&dirty);
+
+	for (int i = 0; i < PERSIST_ITEMS; i++) {
+		persist_key(key, i);
+		settings_delete(key);
+		stored[i].len = 0;
+	}
+}
+
+#endif /* CONFIG_GL_PERSIST */
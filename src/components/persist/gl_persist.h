@@ -0,0 +1,77 @@
+/*****************************************************************************
+ * @file  gl_persist.h
+ * @brief The header file of gl_persist.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_PERSIST_H_
+#define _GL_PERSIST_H_
+
+#include <zephyr/types.h>
+
+/* Largest state of one item */
+#define PERSIST_MAX_LEN 16
+
+enum persist_item {
+	PERSIST_REPORT_INTERVAL,
+	PERSIST_LED_STRIP,
+	PERSIST_GPIO,
+	PERSIST_LINK_MODE,
+	PERSIST_ITEMS
+};
+
+/* Fills data with the current state of an item, returns its length */
+typedef size_t (*persist_get_fn_t)(uint8_t data[PERSIST_MAX_LEN]);
+
+/* Applies the stored state of an item */
+typedef void (*persist_set_fn_t)(const uint8_t *data, size_t len);
+
+struct persist_item_ops {
+	const char *name;
+	persist_get_fn_t get;
+	persist_set_fn_t set;
+};
+
+/** @brief Restore the stored items.
+ *
+ * Must be called after settings_subsys_init(). The set handler of every
+ * stored item runs before this returns.
+ *
+ * @param[in] ops handlers of every item, indexed by enum persist_item.
+ */
+void persist_init(const struct persist_item_ops *ops);
+
+/** @brief Store the state of an item.
+ *
+ * The state is read and written CONFIG_GL_PERSIST_SAVE_DELAY ms after the
+ * first change, so a burst of changes costs one write per item. A state
+ * equal to the stored one is not written again.
+ *
+ * @param[in] item changed item.
+ */
+void persist_mark(enum persist_item item);
+
+/** @brief Write the changed items at once, e.g. before a reboot.
+ *
+ * Must be called from the low priority work queue.
+ */
+void persist_flush(void);
+
+/** @brief Delete all stored items.
+ */
+void persist_clear(void);
+
+#endif /* _GL_PERSIST_H_ */
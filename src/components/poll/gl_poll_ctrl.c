@@ -0,0 +1,209 @@
+/*****************************************************************************
+ * @file  gl_poll_ctrl.c
+ * @brief Reference counted fast poll period controller for sleepy devices.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/thread.h>
+#include <openthread/link.h>
+
+#include "gl_poll_ctrl.h"
+#include "gl_workq.h"
+
+LOG_MODULE_REGISTER(gl_poll_ctrl, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+#define HOLDER_IDX(h) ((h) & 0xff)
+#define HOLDER_GEN(h) (((h) >> 8) & 0xff)
+#define HOLDER_MAKE(idx, gen) (((gen) << 8) | (idx))
+
+struct poll_holder {
+	bool in_use;
+	uint8_t gen;
+	int64_t expire_at;
+};
+
+static struct poll_holder holders[CONFIG_GL_POLL_CTRL_MAX_HOLDERS];
+static struct k_spinlock holders_lock;
+static struct k_work_delayable poll_update_work;
+
+/* Poll period in use before the fast period was applied, 0 when idle */
+static uint32_t idle_poll_period;
+
+static int collect_holders(int64_t now, int64_t *next_expiry)
+{
+	int active = 0;
+
+	*next_expiry = INT64_MAX;
+
+	for (size_t i = 0; i < ARRAY_SIZE(holders); i++) {
+		if (!holders[i].in_use) {
+			continue;
+		}
+
+		if (holders[i].expire_at <= now) {
+			LOG_WRN("Fast poll holder %d expired", HOLDER_MAKE(i, holders[i].gen));
+			holders[i].in_use = false;
+			continue;
+		}
+
+		active++;
+		*next_expiry = MIN(*next_expiry, holders[i].expire_at);
+	}
+
+	return active;
+}
+
+static void poll_period_fast_set(otInstance *instance)
+{
+	otError error;
+
+	if (otThreadGetLinkMode(instance).mRxOnWhenIdle || idle_poll_period) {
+		return;
+	}
+
+	idle_poll_period = otLinkGetPollPeriod(instance);
+
+	error = otLinkSetPollPeriod(instance, CONFIG_GL_POLL_CTRL_FAST_PERIOD);
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to set poll period, error: %d", error);
+		idle_poll_period = 0;
+		return;
+	}
+
+	LOG_INF("Poll Period: %dms set", CONFIG_GL_POLL_CTRL_FAST_PERIOD);
+}
+
+static void poll_period_idle_restore(otInstance *instance)
+{
+	otError error;
+
+	if (!idle_poll_period) {
+		return;
+	}
+
+	error = otLinkSetPollPeriod(instance, idle_poll_period);
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to restore poll period, error: %d", error);
+	} else {
+		LOG_INF("Poll Period: %dms restored", idle_poll_period);
+	}
+
+	idle_poll_period = 0;
+}
+
+static void poll_ctrl_update(struct k_work *item)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	k_spinlock_key_t key;
+	int64_t now = k_uptime_get();
+	int64_t next_expiry;
+	int active;
+
+	ARG_UNUSED(item);
+
+	key = k_spin_lock(&holders_lock);
+	active = collect_holders(now, &next_expiry);
+	k_spin_unlock(&holders_lock, key);
+
+	if (!IS_ENABLED(CONFIG_OPENTHREAD_MTD_SED) || context == NULL) {
+		return;
+	}
+
+	openthread_api_mutex_lock(context);
+	if (active) {
+		poll_period_fast_set(context->instance);
+	} else {
+		poll_period_idle_restore(context->instance);
+	}
+	openthread_api_mutex_unlock(context);
+
+	if (active) {
+		k_work_reschedule_for_queue(&gl_workq_hi, &poll_update_work, K_MSEC(next_expiry - now));
+	}
+}
+
+void poll_ctrl_init(void)
+{
+	k_work_init_delayable(&poll_update_work, poll_ctrl_update);
+}
+
+int poll_ctrl_hold(uint32_t timeout_ms)
+{
+	int holder = POLL_CTRL_NO_HOLDER;
+	k_spinlock_key_t key = k_spin_lock(&holders_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(holders); i++) {
+		if (!holders[i].in_use) {
+			holders[i].in_use = true;
+			holders[i].gen++;
+			holders[i].expire_at = k_uptime_get() + timeout_ms;
+			holder = HOLDER_MAKE(i, holders[i].gen);
+			break;
+		}
+	}
+
+	k_spin_unlock(&holders_lock, key);
+
+	if (holder == POLL_CTRL_NO_HOLDER) {
+		LOG_WRN("No free fast poll holder");
+		return holder;
+	}
+
+	k_work_reschedule_for_queue(&gl_workq_hi, &poll_update_work, K_NO_WAIT);
+
+	return holder;
+}
+
+void poll_ctrl_release(int holder)
+{
+	bool released = false;
+	k_spinlock_key_t key;
+
+	if (holder < 0 || HOLDER_IDX(holder) >= ARRAY_SIZE(holders)) {
+		return;
+	}
+
+	key = k_spin_lock(&holders_lock);
+	if (holders[HOLDER_IDX(holder)].in_use &&
+	    holders[HOLDER_IDX(holder)].gen == HOLDER_GEN(holder)) {
+		holders[HOLDER_IDX(holder)].in_use = false;
+		released = true;
+	}
+	k_spin_unlock(&holders_lock, key);
+
+	if (released) {
+		k_work_reschedule_for_queue(&gl_workq_hi, &poll_update_work, K_NO_WAIT);
+	}
+}
+
+int poll_ctrl_active_holders(void)
+{
+	int active = 0;
+	k_spinlock_key_t key = k_spin_lock(&holders_lock);
+
+	for (size_t i = 0; i < ARRAY_SIZE(holders); i++) {
+		if (holders[i].in_use) {
+			active++;
+		}
+	}
+
+	k_spin_unlock(&holders_lock, key);
+
+	return active;
+}
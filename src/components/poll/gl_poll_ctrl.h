@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * @file  gl_poll_ctrl.h
+ * @brief The header file of gl_poll_ctrl.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_POLL_CTRL_H_
+#define _GL_POLL_CTRL_H_
+
+#include <zephyr/types.h>
+
+#define POLL_CTRL_NO_HOLDER (-1)
+
+/** @brief Initialize the poll period controller.
+ */
+void poll_ctrl_init(void);
+
+/** @brief Request the fast poll period until released or timed out.
+ *
+ * While at least one holder is active a sleepy end device polls its parent
+ * every CONFIG_GL_POLL_CTRL_FAST_PERIOD ms. The idle period is restored as
+ * soon as the last holder is released or expires.
+ *
+ * @param[in] timeout_ms maximum time the hold stays active.
+ *
+ * @return holder handle, or POLL_CTRL_NO_HOLDER if no slot is free.
+ */
+int poll_ctrl_hold(uint32_t timeout_ms);
+
+/** @brief Release a holder returned by poll_ctrl_hold().
+ *
+ * Releasing an expired or already released holder is a no-op.
+ *
+ * @param[in] holder holder handle.
+ */
+void poll_ctrl_release(int holder);
+
+/** @brief Number of currently active fast poll holders.
+ */
+int poll_ctrl_active_holders(void);
+
+#endif /* _GL_POLL_CTRL_H_ */
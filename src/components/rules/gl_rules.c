@@ -0,0 +1,405 @@
+/*****************************************************************************
+ * @file  gl_rules.c
+ * @brief Local sensor and trigger to actuator rules.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/settings/settings.h>
+
+#include "gl_rules.h"
+#include "gl_cjson_utils.h"
+#include "gl_lookup.h"
+#include "gl_sensor.h"
+#include "gl_battery.h"
+#include "gl_gpio.h"
+#include "gl_led.h"
+#include "gl_led_strip.h"
+#include "gl_workq.h"
+
+#ifdef CONFIG_GL_RULES
+
+LOG_MODULE_REGISTER(gl_rules, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+#define RULES_SETTINGS_ROOT "gl/rules"
+#define RULES_SETTINGS_TABLE RULES_SETTINGS_ROOT "/table"
+
+#define RULES_EVENT_QUEUE_SIZE 8
+
+/* Stored as is in settings, keep the layout stable */
+struct rule {
+	uint8_t src; /* enum rule_src */
+	uint8_t obj; /* trigger event, enum rule_sensor or gl_gpio_node_e */
+	uint8_t op; /* enum rule_op */
+	uint8_t act; /* enum rule_act */
+	uint8_t target; /* LED strip node or gl_gpio_node_e */
+	uint8_t val; /* LED on/off/toggle or GPIO level */
+	uint8_t r, g, b;
+	float threshold;
+};
+
+struct rule_event {
+	int event;
+	double value;
+};
+
+/* Written on the low priority work queue, trigger rules are evaluated on the
+ * high priority one, so replacing the table and reading it from there holds
+ * rules_lock.
+ */
+static struct rule rules[CONFIG_GL_RULES_MAX];
+static size_t rules_count;
+static K_MUTEX_DEFINE(rules_lock);
+/* Level rules fire when their condition starts to hold, low queue only */
+static uint32_t rules_holding;
+
+K_MSGQ_DEFINE(rules_events, sizeof(struct rule_event), RULES_EVENT_QUEUE_SIZE, 4);
+static struct k_work rules_event_work;
+static struct k_work_delayable rules_poll_work;
+
+static bool rule_holds(const struct rule *rule, double value)
+{
+	switch (rule->op) {
+	case RULE_OP_LT:
+		return value < rule->threshold;
+	case RULE_OP_GT:
+		return value > rule->threshold;
+	case RULE_OP_EQ:
+		return value == rule->threshold;
+	case RULE_OP_NE:
+		return value != rule->threshold;
+	default:
+		return true;
+	}
+}
+
+static void rule_act(const struct rule *rule)
+{
+	struct led_rgb color = RGB(rule->r, rule->g, rule->b);
+	int ret = 0;
+
+	switch (rule->act) {
+	case RULE_ACT_ONOFF:
+		ret = on_off_led_strip(rule->target, rule->val);
+		break;
+	case RULE_ACT_CHANGE_COLOR:
+		ret = update_led_strip_rgb(rule->target, &color);
+		break;
+	case RULE_ACT_NEXT_COLOR:
+		ret = update_led_strip_rgb_to_next();
+		break;
+	case RULE_ACT_SET_GPIO:
+		ret = gl_set_gpio_status_by_id(rule->target, rule->val);
+		break;
+	default:
+		break;
+	}
+
+	if (ret) {
+		LOG_ERR("Rule action %d failed: %d", rule->act, ret);
+	}
+}
+
+static bool rules_need_poll(void)
+{
+	for (size_t i = 0; i < rules_count; i++) {
+		if (rules[i].src != RULE_SRC_TRIGGER) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static double rules_sensor_value(uint8_t sensor)
+{
+	switch (sensor) {
+	case RULE_SENSOR_TEMPERATURE:
+		return gl_sensor_get_temp();
+	case RULE_SENSOR_HUMIDITY:
+		return gl_sensor_get_humi();
+	case RULE_SENSOR_LIGHT:
+		return gl_sensor_get_light();
+	case RULE_SENSOR_PRESS:
+		return gl_sensor_get_press();
+	default:
+		return gl_battery_get_level();
+	}
+}
+
+static void rules_poll(struct k_work *item)
+{
+	bool fetched = false;
+	double value;
+	bool holds;
+
+	ARG_UNUSED(item);
+
+	if (!rules_need_poll()) {
+		return;
+	}
+
+	for (size_t i = 0; i < rules_count; i++) {
+		if (rules[i].src == RULE_SRC_SENSOR) {
+			if (!fetched) {
+				gl_sensor_sample_fetch();
+				fetched = true;
+			}
+			value = rules_sensor_value(rules[i].obj);
+		} else if (rules[i].src == RULE_SRC_GPIO) {
+			value = gl_get_gpio_status(rules[i].obj);
+		} else {
+			continue;
+		}
+
+		holds = rule_holds(&rules[i], value);
+		if (holds && !(rules_holding & BIT(i))) {
+			LOG_INF("Rule %zu fired", i);
+			rule_act(&rules[i]);
+		}
+		WRITE_BIT(rules_holding, i, holds);
+	}
+
+	k_work_reschedule_for_queue(&gl_workq_lo, &rules_poll_work,
+				    K_SECONDS(CONFIG_GL_RULES_POLL_INTERVAL));
+}
+
+static void rules_event(struct k_work *item)
+{
+	struct rule_event ev;
+
+	ARG_UNUSED(item);
+
+	while (k_msgq_get(&rules_events, &ev, K_NO_WAIT) == 0) {
+		k_mutex_lock(&rules_lock, K_FOREVER);
+		for (size_t i = 0; i < rules_count; i++) {
+			if (rules[i].src == RULE_SRC_TRIGGER && rules[i].obj == ev.event &&
+			    rule_holds(&rules[i], ev.value)) {
+				LOG_INF("Rule %zu fired", i);
+				rule_act(&rules[i]);
+			}
+		}
+		k_mutex_unlock(&rules_lock);
+	}
+}
+
+static int rules_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+			      void *cb_arg)
+{
+	const char *next;
+	int rc;
+
+	if (settings_name_steq(key, "table", &next) && !next) {
+		if (len % sizeof(struct rule) || len > sizeof(rules)) {
+			return -EINVAL;
+		}
+
+		rc = read_cb(cb_arg, rules, len);
+		if (rc < 0) {
+			return rc;
+		}
+
+		rules_count = len / sizeof(struct rule);
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+static struct settings_handler rules_settings = {
+	.name = RULES_SETTINGS_ROOT,
+	.h_set = rules_settings_set,
+};
+
+static int rule_parse_cond(cJSON *cond_obj, struct rule *rule)
+{
+	const char *obj = gl_json_get_string(cond_obj, "obj");
+	int src = gl_lookup_find(&gl_lookup_rule_src, gl_json_get_string(cond_obj, "src"));
+	int id, op = RULE_OP_ANY;
+
+	switch (src) {
+	case RULE_SRC_TRIGGER:
+		id = gl_lookup_find(&gl_lookup_trigger, obj);
+		break;
+	case RULE_SRC_SENSOR:
+		id = gl_lookup_find(&gl_lookup_rule_sensor, obj);
+		break;
+	case RULE_SRC_GPIO:
+		id = gl_lookup_find(&gl_lookup_gpio, obj);
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (id == GL_LOOKUP_NONE) {
+		return -EINVAL;
+	}
+
+	if (cJSON_HasObjectItem(cond_obj, "op")) {
+		op = gl_lookup_find(&gl_lookup_rule_op, gl_json_get_string(cond_obj, "op"));
+		if (op == GL_LOOKUP_NONE || !cJSON_HasObjectItem(cond_obj, "val")) {
+			return -EINVAL;
+		}
+		rule->threshold = cJSON_GetObjectItem(cond_obj, "val")->valuedouble;
+	} else if (src != RULE_SRC_TRIGGER) {
+		/* A level without a comparison would fire once and never again */
+		return -EINVAL;
+	}
+
+	rule->src = src;
+	rule->obj = id;
+	rule->op = op;
+
+	return 0;
+}
+
+static int rule_parse_color(cJSON *act_obj, const char *key, uint8_t *channel)
+{
+	cJSON *item = cJSON_GetObjectItem(act_obj, key);
+
+	if (!cJSON_IsNumber(item) || item->valueint < 0 || item->valueint > UINT8_MAX) {
+		return -EINVAL;
+	}
+
+	*channel = item->valueint;
+
+	return 0;
+}
+
+static int rule_parse_action(cJSON *act_obj, struct rule *rule)
+{
+	int act = gl_lookup_find(&gl_lookup_rule_act, gl_json_get_string(act_obj, "act"));
+	int target = 0;
+	int val;
+
+	switch (act) {
+	case RULE_ACT_ONOFF:
+	case RULE_ACT_CHANGE_COLOR:
+		target = gl_lookup_find(&gl_lookup_led_obj, gl_json_get_string(act_obj, "obj"));
+		break;
+	case RULE_ACT_SET_GPIO:
+		target = gl_lookup_find(&gl_lookup_gpio, gl_json_get_string(act_obj, "obj"));
+		break;
+	case RULE_ACT_NEXT_COLOR:
+		break;
+	default:
+		return -EINVAL;
+	}
+
+	if (target == GL_LOOKUP_NONE) {
+		return -EINVAL;
+	}
+
+	rule->act = act;
+	rule->target = target;
+
+	if (act == RULE_ACT_ONOFF) {
+		val = gl_json_get_int(act_obj, "val");
+		if (val < LED_OFF || val > LED_TOGGLE) {
+			return -EINVAL;
+		}
+		rule->val = val;
+	} else if (act == RULE_ACT_SET_GPIO) {
+		rule->val = gl_json_get_boolean(act_obj, "val");
+	} else if (act == RULE_ACT_CHANGE_COLOR) {
+		if (rule_parse_color(act_obj, "r", &rule->r) ||
+		    rule_parse_color(act_obj, "g", &rule->g) ||
+		    rule_parse_color(act_obj, "b", &rule->b)) {
+			return -EINVAL;
+		}
+	}
+
+	return 0;
+}
+
+void rules_init(void)
+{
+	k_work_init(&rules_event_work, rules_event);
+	k_work_init_delayable(&rules_poll_work, rules_poll);
+
+	settings_register(&rules_settings);
+	settings_load_subtree(RULES_SETTINGS_ROOT);
+
+	if (rules_count) {
+		LOG_INF("Restored %zu rules", rules_count);
+	}
+
+	k_work_schedule_for_queue(&gl_workq_lo, &rules_poll_work, K_NO_WAIT);
+}
+
+int rules_set(cJSON *rules_arr)
+{
+	struct rule parsed[CONFIG_GL_RULES_MAX];
+	cJSON *rule_obj;
+	int count = 0;
+
+	if (!cJSON_IsArray(rules_arr)) {
+		return -EINVAL;
+	}
+
+	if (cJSON_GetArraySize(rules_arr) > CONFIG_GL_RULES_MAX) {
+		return -ENOMEM;
+	}
+
+	memset(parsed, 0, sizeof(parsed));
+
+	cJSON_ArrayForEach(rule_obj, rules_arr) {
+		if (rule_parse_cond(cJSON_GetObjectItem(rule_obj, "if"), &parsed[count]) ||
+		    rule_parse_action(cJSON_GetObjectItem(rule_obj, "then"), &parsed[count])) {
+			LOG_ERR("Rule %d is invalid", count);
+			return -EINVAL;
+		}
+		count++;
+	}
+
+	if (settings_save_one(RULES_SETTINGS_TABLE, parsed, count * sizeof(parsed[0]))) {
+		LOG_ERR("Failed to store rules");
+		return -EIO;
+	}
+
+	k_mutex_lock(&rules_lock, K_FOREVER);
+	memcpy(rules, parsed, sizeof(rules));
+	rules_count = count;
+	k_mutex_unlock(&rules_lock);
+	rules_holding = 0;
+
+	LOG_INF("%d rules set", count);
+
+	/* Level rules are checked at once against the new thresholds */
+	k_work_reschedule_for_queue(&gl_workq_lo, &rules_poll_work, K_NO_WAIT);
+
+	return count;
+}
+
+void rules_on_trigger(int event, double value)
+{
+	struct rule_event ev = {
+		.event = event,
+		.value = value,
+	};
+
+	if (k_msgq_put(&rules_events, &ev, K_NO_WAIT)) {
+		LOG_WRN("Rule event queue full, event %d dropped", event);
+		return;
+	}
+
+	/* User input, react without waiting behind sensor fetches */
+	k_work_submit_to_queue(&gl_workq_hi, &rules_event_work);
+}
+
+#endif /* CONFIG_GL_RULES */
@@ -0,0 +1,88 @@
+/*****************************************************************************
+ * @file  gl_rules.h
+ * @brief The header file of gl_rules.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_RULES_H_
+#define _GL_RULES_H_
+
+#include <zephyr/types.h>
+#include <cJSON.h>
+
+/* What a rule watches, "src" of the condition */
+enum rule_src {
+	RULE_SRC_TRIGGER,
+	RULE_SRC_SENSOR,
+	RULE_SRC_GPIO,
+};
+
+/* "obj" of a sensor condition */
+enum rule_sensor {
+	RULE_SENSOR_TEMPERATURE,
+	RULE_SENSOR_HUMIDITY,
+	RULE_SENSOR_LIGHT,
+	RULE_SENSOR_PRESS,
+	RULE_SENSOR_BATTERY,
+};
+
+/* "op" of a condition, a condition without "op" always holds */
+enum rule_op {
+	RULE_OP_ANY,
+	RULE_OP_LT,
+	RULE_OP_GT,
+	RULE_OP_EQ,
+	RULE_OP_NE,
+};
+
+/* "act" of the action */
+enum rule_act {
+	RULE_ACT_ONOFF,
+	RULE_ACT_CHANGE_COLOR,
+	RULE_ACT_NEXT_COLOR,
+	RULE_ACT_SET_GPIO,
+};
+
+/** @brief Restore the rules from settings.
+ *
+ * Must be called after settings_subsys_init().
+ */
+void rules_init(void);
+
+/** @brief Replace the rule table and store it.
+ *
+ * Must be called from the low priority work queue.
+ *
+ * @param[in] rules_arr array of {"if":{...},"then":{...}} objects, an empty
+ *            array removes all rules.
+ *
+ * @return number of rules, -EINVAL if a rule is malformed, -ENOMEM if there
+ *         are more than CONFIG_GL_RULES_MAX rules, -EIO if they could not
+ *         be stored. The table is unchanged on error.
+ */
+int rules_set(cJSON *rules_arr);
+
+/** @brief Run the rules watching a trigger event.
+ *
+ * May be called from any thread, the actions run on the high priority
+ * work queue.
+ *
+ * @param[in] event trigger_event_type_e of the event.
+ * @param[in] value value of the event, 0 if it has none.
+ */
+void rules_on_trigger(int event, double value);
+
+#endif /* _GL_RULES_H_ */
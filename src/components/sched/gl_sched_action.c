@@ -0,0 +1,93 @@
+/*****************************************************************************
+ * @file  gl_sched_action.c
+ * @brief Deferred execution of disruptive actions once pending frames are sent.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/message.h>
+
+#include "gl_sched_action.h"
+#include "gl_workq.h"
+
+LOG_MODULE_REGISTER(gl_sched_action, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+/* How often the send queues are checked while an action is pending */
+#define SCHED_ACTION_POLL_MS 50
+
+static struct k_work_delayable sched_action_work;
+static atomic_ptr_t pending_action = ATOMIC_PTR_INIT(NULL);
+static int64_t deadline;
+
+static bool sched_action_tx_idle(void)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	otBufferInfo info;
+
+	openthread_api_mutex_lock(context);
+	otMessageGetBufferInfo(context->instance, &info);
+	openthread_api_mutex_unlock(context);
+
+	return info.mIp6Queue.mNumMessages == 0 && info.m6loSendQueue.mNumMessages == 0;
+}
+
+static void sched_action_run(struct k_work *item)
+{
+	sched_action_fn_t fn = (sched_action_fn_t)atomic_ptr_get(&pending_action);
+
+	ARG_UNUSED(item);
+
+	if (fn == NULL) {
+		return;
+	}
+
+	if (!sched_action_tx_idle()) {
+		if (k_uptime_get() < deadline) {
+			k_work_reschedule_for_queue(&gl_workq_lo, &sched_action_work,
+						    K_MSEC(SCHED_ACTION_POLL_MS));
+			return;
+		}
+
+		LOG_WRN("Send queues not drained, running action anyway");
+	}
+
+	/* Cleared first so that the action can schedule its next step */
+	atomic_ptr_clear(&pending_action);
+	fn();
+}
+
+void sched_action_init(void)
+{
+	k_work_init_delayable(&sched_action_work, sched_action_run);
+}
+
+int sched_action_after_tx(sched_action_fn_t fn)
+{
+	if (!atomic_ptr_cas(&pending_action, NULL, (atomic_ptr_val_t)fn)) {
+		LOG_WRN("Another action is already scheduled");
+		return -EBUSY;
+	}
+
+	deadline = k_uptime_get() + CONFIG_GL_SCHED_ACTION_TIMEOUT;
+
+	/* Let the caller queue its response before the first check */
+	k_work_reschedule_for_queue(&gl_workq_lo, &sched_action_work,
+				    K_MSEC(SCHED_ACTION_POLL_MS));
+
+	return 0;
+}
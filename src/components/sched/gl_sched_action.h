@@ -0,0 +1,45 @@
+/*****************************************************************************
+ * @file  gl_sched_action.h
+ * @brief The header file of gl_sched_action.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_SCHED_ACTION_H_
+#define _GL_SCHED_ACTION_H_
+
+#include <zephyr/types.h>
+
+typedef void (*sched_action_fn_t)(void);
+
+/** @brief Initialize the scheduled action service.
+ */
+void sched_action_init(void);
+
+/** @brief Run an action once the frames queued so far have left the radio.
+ *
+ * Meant for reboot and factory reset requested over CoAP: the request
+ * handler queues its response, schedules the action and returns at once.
+ * The action runs on the low priority work queue when the OpenThread send
+ * queues are empty, or after CONFIG_GL_SCHED_ACTION_TIMEOUT ms at the latest.
+ * An action may schedule the next step of a sequence.
+ *
+ * @param[in] fn action to run.
+ *
+ * @return 0 on success, -EBUSY if another action is pending.
+ */
+int sched_action_after_tx(sched_action_fn_t fn);
+
+#endif /* _GL_SCHED_ACTION_H_ */
@@ -0,0 +1,358 @@
+/*****************************************************************************
+ * @file  gl_senml.c
+ * @brief Buffered sensor samples sent as SenML packs (RFC 8428).
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
+
+#include "gl_senml.h"
+#include "gl_sensor.h"
+#include "gl_battery.h"
+#include "gl_workq.h"
+
+#ifdef CONFIG_GL_SENML_REPORT
+
+LOG_MODULE_REGISTER(gl_senml, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+/* SenML CBOR labels */
+#define SENML_LABEL_BN (-2)
+#define SENML_LABEL_BT (-3)
+#define SENML_LABEL_N 0
+#define SENML_LABEL_U 1
+#define SENML_LABEL_V 2
+#define SENML_LABEL_T 6
+
+#define CBOR_UINT 0
+#define CBOR_NINT 1
+#define CBOR_TSTR 3
+#define CBOR_MAP 5
+#define CBOR_FLOAT32 0xfa
+#define CBOR_ARRAY_INDEF 0x9f
+#define CBOR_BREAK 0xff
+
+enum senml_channel {
+	SENML_TEMPERATURE,
+	SENML_HUMIDITY,
+	SENML_LIGHT,
+	SENML_PRESSURE,
+	SENML_BATTERY,
+	SENML_CHANNELS
+};
+
+static const struct {
+	const char *name;
+	const char *unit;
+} channels[SENML_CHANNELS] = {
+	[SENML_TEMPERATURE] = { "temp", "Cel" },
+	[SENML_HUMIDITY] = { "humi", "%RH" },
+	[SENML_LIGHT] = { "light", "lx" },
+	[SENML_PRESSURE] = { "press", "Pa" },
+	[SENML_BATTERY] = { "batt", "%EL" },
+};
+
+struct senml_sample {
+	uint32_t at; /* uptime, s */
+	float v[SENML_CHANNELS];
+};
+
+struct senml_writer {
+	uint8_t *buf;
+	size_t size;
+	size_t len;
+	bool overflow;
+};
+
+/* Ring of samples, only used from the low priority work queue */
+static struct senml_sample samples[CONFIG_GL_SENML_MAX_SAMPLES];
+static size_t samples_head;
+static size_t samples_count;
+/* Oldest samples dropped since the last pack was encoded, they are no
+ * longer at the head when that pack is released.
+ */
+static size_t samples_dropped;
+
+static struct k_work_delayable sample_work;
+static senml_full_cb_t on_full;
+
+static uint32_t uptime_s(void)
+{
+	return k_uptime_get() / MSEC_PER_SEC;
+}
+
+static void senml_sample(struct k_work *item)
+{
+	struct senml_sample *sample;
+
+	ARG_UNUSED(item);
+
+	k_work_reschedule_for_queue(&gl_workq_lo, &sample_work,
+				    K_SECONDS(CONFIG_GL_SENML_SAMPLE_INTERVAL));
+
+	if (samples_count == ARRAY_SIZE(samples)) {
+		LOG_WRN("SenML buffer full, oldest sample dropped");
+		samples_head = (samples_head + 1) % ARRAY_SIZE(samples);
+		samples_count--;
+		samples_dropped++;
+	}
+
+	gl_sensor_sample_fetch();
+
+	sample = &samples[(samples_head + samples_count) % ARRAY_SIZE(samples)];
+	sample->at = uptime_s();
+	sample->v[SENML_TEMPERATURE] = gl_sensor_get_temp();
+	sample->v[SENML_HUMIDITY] = gl_sensor_get_humi();
+	sample->v[SENML_LIGHT] = gl_sensor_get_light();
+	/* The sensor API reports kPa */
+	sample->v[SENML_PRESSURE] = gl_sensor_get_press() * 1000;
+	sample->v[SENML_BATTERY] = gl_battery_get_level();
+	samples_count++;
+
+	if (samples_count == ARRAY_SIZE(samples) && on_full != NULL) {
+		on_full();
+	}
+}
+
+static void writer_put(struct senml_writer *w, const void *data, size_t len)
+{
+	if (w->overflow || w->len + len > w->size) {
+		w->overflow = true;
+		return;
+	}
+
+	memcpy(&w->buf[w->len], data, len);
+	w->len += len;
+}
+
+#ifdef CONFIG_GL_SENML_FORMAT_JSON
+static void writer_printf(struct senml_writer *w, const char *fmt, ...)
+{
+	size_t room = w->overflow ? 0 : w->size - w->len;
+	va_list args;
+	int n;
+
+	va_start(args, fmt);
+	n = vsnprintf((char *)&w->buf[w->len], room, fmt, args);
+	va_end(args);
+
+	if (n < 0 || (size_t)n >= room) {
+		w->overflow = true;
+		return;
+	}
+
+	w->len += n;
+}
+
+static void pack_begin(struct senml_writer *w)
+{
+	writer_put(w, "[", 1);
+}
+
+static void pack_end(struct senml_writer *w)
+{
+	writer_put(w, "]", 1);
+}
+
+static void pack_record(struct senml_writer *w, bool first, const char *eui64, int32_t bt,
+			enum senml_channel ch, uint32_t t, float v)
+{
+	if (first) {
+		writer_printf(w, "{\"bn\":\"urn:dev:mac:%s:\",\"bt\":%d,", eui64, bt);
+	} else {
+		writer_put(w, ",{", 2);
+	}
+
+	writer_printf(w, "\"n\":\"%s\",\"u\":\"%s\",", channels[ch].name, channels[ch].unit);
+	if (t) {
+		writer_printf(w, "\"t\":%u,", t);
+	}
+	writer_printf(w, "\"v\":%g}", (double)v);
+}
+#else
+static void cbor_head(struct senml_writer *w, uint8_t major, uint32_t arg)
+{
+	uint8_t head[5];
+	size_t len;
+
+	if (arg < 24) {
+		head[0] = (major << 5) | arg;
+		len = 1;
+	} else if (arg <= UINT8_MAX) {
+		head[0] = (major << 5) | 24;
+		head[1] = arg;
+		len = 2;
+	} else if (arg <= UINT16_MAX) {
+		head[0] = (major << 5) | 25;
+		sys_put_be16(arg, &head[1]);
+		len = 3;
+	} else {
+		head[0] = (major << 5) | 26;
+		sys_put_be32(arg, &head[1]);
+		len = 5;
+	}
+
+	writer_put(w, head, len);
+}
+
+static void cbor_int(struct senml_writer *w, int32_t value)
+{
+	if (value < 0) {
+		cbor_head(w, CBOR_NINT, -1 - value);
+	} else {
+		cbor_head(w, CBOR_UINT, value);
+	}
+}
+
+static void cbor_tstr(struct senml_writer *w, const char *str)
+{
+	size_t len = strlen(str);
+
+	cbor_head(w, CBOR_TSTR, len);
+	writer_put(w, str, len);
+}
+
+static void cbor_float(struct senml_writer *w, float value)
+{
+	uint8_t buf[5] = { CBOR_FLOAT32 };
+	uint32_t bits;
+
+	memcpy(&bits, &value, sizeof(bits));
+	sys_put_be32(bits, &buf[1]);
+	writer_put(w, buf, sizeof(buf));
+}
+
+static void pack_begin(struct senml_writer *w)
+{
+	uint8_t head = CBOR_ARRAY_INDEF;
+
+	writer_put(w, &head, 1);
+}
+
+static void pack_end(struct senml_writer *w)
+{
+	uint8_t tail = CBOR_BREAK;
+
+	writer_put(w, &tail, 1);
+}
+
+static void pack_record(struct senml_writer *w, bool first, const char *eui64, int32_t bt,
+			enum senml_channel ch, uint32_t t, float v)
+{
+	char bn[32];
+
+	cbor_head(w, CBOR_MAP, 3 + (t ? 1 : 0) + (first ? 2 : 0));
+
+	if (first) {
+		snprintf(bn, sizeof(bn), "urn:dev:mac:%s:", eui64);
+		cbor_int(w, SENML_LABEL_BN);
+		cbor_tstr(w, bn);
+		cbor_int(w, SENML_LABEL_BT);
+		cbor_int(w, bt);
+	}
+
+	cbor_int(w, SENML_LABEL_N);
+	cbor_tstr(w, channels[ch].name);
+	cbor_int(w, SENML_LABEL_U);
+	cbor_tstr(w, channels[ch].unit);
+	if (t) {
+		cbor_int(w, SENML_LABEL_T);
+		cbor_int(w, t);
+	}
+	cbor_int(w, SENML_LABEL_V);
+	cbor_float(w, v);
+}
+#endif /* CONFIG_GL_SENML_FORMAT_JSON */
+
+void senml_init(senml_full_cb_t full_cb)
+{
+	on_full = full_cb;
+
+	k_work_init_delayable(&sample_work, senml_sample);
+	k_work_schedule_for_queue(&gl_workq_lo, &sample_work,
+				  K_SECONDS(CONFIG_GL_SENML_SAMPLE_INTERVAL));
+}
+
+int senml_pack_encode(uint8_t *buf, size_t size, const char *eui64, size_t *len)
+{
+	struct senml_writer w = {
+		.buf = buf,
+		.size = size - 1, /* room for the end of the pack */
+	};
+	const struct senml_sample *sample;
+	uint32_t base;
+	size_t mark;
+	int encoded = 0;
+
+	if (samples_count == 0) {
+		return 0;
+	}
+
+	samples_dropped = 0;
+	base = samples[samples_head].at;
+
+	pack_begin(&w);
+
+	for (size_t i = 0; i < samples_count; i++) {
+		sample = &samples[(samples_head + i) % ARRAY_SIZE(samples)];
+		mark = w.len;
+
+		for (int ch = 0; ch < SENML_CHANNELS; ch++) {
+			pack_record(&w, i == 0 && ch == 0, eui64, (int32_t)(base - uptime_s()), ch,
+				    sample->at - base, sample->v[ch]);
+		}
+
+		if (w.overflow) {
+			w.len = mark;
+			w.overflow = false;
+			break;
+		}
+
+		encoded++;
+	}
+
+	if (encoded == 0) {
+		LOG_ERR("One sample does not fit into %zu bytes", size);
+		return -ENOMEM;
+	}
+
+	w.size = size;
+	pack_end(&w);
+	*len = w.len;
+
+	return encoded;
+}
+
+void senml_pack_release(int samples_sent)
+{
+	samples_sent -= MIN(samples_sent, samples_dropped);
+	samples_dropped = 0;
+	samples_sent = MIN(samples_sent, samples_count);
+
+	samples_head = (samples_head + samples_sent) % ARRAY_SIZE(samples);
+	samples_count -= samples_sent;
+}
+
+size_t senml_pending(void)
+{
+	return samples_count;
+}
+
+#endif /* CONFIG_GL_SENML_REPORT */
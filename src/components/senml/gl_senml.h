@@ -0,0 +1,74 @@
+/*****************************************************************************
+ * @file  gl_senml.h
+ * @brief The header file of gl_senml.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_SENML_H_
+#define _GL_SENML_H_
+
+#include <zephyr/types.h>
+#include <openthread/coap.h>
+
+#ifdef CONFIG_GL_SENML_FORMAT_JSON
+#define SENML_CONTENT_FORMAT OT_COAP_OPTION_CONTENT_FORMAT_SENML_JSON
+#else
+#define SENML_CONTENT_FORMAT OT_COAP_OPTION_CONTENT_FORMAT_SENML_CBOR
+#endif
+
+/* Called on the low priority work queue when the sample buffer is full */
+typedef void (*senml_full_cb_t)(void);
+
+/** @brief Start sampling the sensors every CONFIG_GL_SENML_SAMPLE_INTERVAL s.
+ *
+ * Up to CONFIG_GL_SENML_MAX_SAMPLES samples are kept, the oldest one is
+ * dropped when a new one does not fit.
+ *
+ * @param[in] full_cb called when the buffer becomes full, may be NULL.
+ */
+void senml_init(senml_full_cb_t full_cb);
+
+/** @brief Encode the oldest buffered samples into one SenML pack.
+ *
+ * The first record carries the base name "urn:dev:mac:<eui64>:" and a
+ * base time relative to now (negative, in seconds), the others a time
+ * relative to the base time. Samples are added as long as the pack fits.
+ * Must be called from the low priority work queue.
+ *
+ * @param[out] buf pack buffer.
+ * @param[in] size size of @p buf.
+ * @param[in] eui64 EUI-64 of the device, as hex string.
+ * @param[out] len pack length.
+ *
+ * @return number of samples encoded, 0 if none is buffered,
+ *         -ENOMEM if not even one sample fits.
+ */
+int senml_pack_encode(uint8_t *buf, size_t size, const char *eui64, size_t *len);
+
+/** @brief Drop the oldest samples once the peer acknowledged their pack.
+ *
+ * Samples of the pack already dropped for new ones are not counted twice.
+ * Must be called from the low priority work queue.
+ *
+ * @param[in] samples number of samples, as returned by senml_pack_encode().
+ */
+void senml_pack_release(int samples);
+
+/** @brief Number of samples waiting to be sent.
+ */
+size_t senml_pending(void);
+
+#endif /* _GL_SENML_H_ */
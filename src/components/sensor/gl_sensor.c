@@ -22,11 +22,31 @@
 #include <zephyr/device.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/drivers/sensor.h>
+#include <zephyr/stats/stats.h>
 
 #include "gl_sensor.h"
 
 LOG_MODULE_REGISTER(gl_sensor, CONFIG_GL_SENSOR_LOG_LEVEL);
 
+/* Fetches and failures per driver, "gl_sensor" group of mcumgr stat */
+STATS_SECT_START(gl_sensor_stats)
+STATS_SECT_ENTRY32(fetch)
+STATS_SECT_ENTRY32(shtcx_err)
+STATS_SECT_ENTRY32(hx3203_err)
+STATS_SECT_ENTRY32(spl0601_err)
+STATS_SECT_ENTRY32(read_err)
+STATS_SECT_END;
+
+STATS_NAME_START(gl_sensor_stats)
+STATS_NAME(gl_sensor_stats, fetch)
+STATS_NAME(gl_sensor_stats, shtcx_err)
+STATS_NAME(gl_sensor_stats, hx3203_err)
+STATS_NAME(gl_sensor_stats, spl0601_err)
+STATS_NAME(gl_sensor_stats, read_err)
+STATS_NAME_END(gl_sensor_stats);
+
+static STATS_SECT_DECL(gl_sensor_stats) gl_sensor_stats;
+
 #ifdef CONFIG_SHTCX
 const struct device *sensor_shtcx = DEVICE_DT_GET_ONE(sensirion_shtcx); //温湿度传感器:温度、湿度
 #endif
@@ -39,6 +59,8 @@ const struct device *sensor_spl0601 = DEVICE_DT_GET_ONE(goertek_spl0601); //气
 
 void gl_sensor_init(void)
 {
+	STATS_INIT_AND_REG(gl_sensor_stats, STATS_SIZE_32, "gl_sensor");
+
 #ifdef CONFIG_SHTCX
 	if (!device_is_ready(sensor_shtcx)) {
 		printf("Device %s is not ready\n", sensor_shtcx->name);
@@ -69,10 +91,13 @@ void gl_sensor_init(void)
 void gl_sensor_sample_fetch(void)
 {
 	int rc;
+
+	STATS_INC(gl_sensor_stats, fetch);
 #ifdef CONFIG_SHTCX
 	rc = sensor_sample_fetch(sensor_shtcx);
 	if (rc != 0) {
 		printk("sensor_sample_fetch sensor_shtcx failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, shtcx_err);
 	}
 #endif
 
@@ -80,6 +105,7 @@ void gl_sensor_sample_fetch(void)
 	rc = sensor_sample_fetch(sensor_hx3203);
 	if (rc != 0) {
 		printk("sensor_sample_fetch sensor_hx3203 failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, hx3203_err);
 	}
 #endif
 
@@ -87,6 +113,7 @@ void gl_sensor_sample_fetch(void)
 	rc = sensor_sample_fetch(sensor_spl0601);
 	if (rc != 0) {
 		printk("sensor_sample_fetch sensor_spl0601 failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, spl0601_err);
 	}
 #endif
 }
@@ -99,6 +126,7 @@ double gl_sensor_get_temp(void)
 	rc = sensor_channel_get(sensor_shtcx, SENSOR_CHAN_AMBIENT_TEMP, &temp);
 	if (rc != 0) {
 		printk("SHT3XD: failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, read_err);
 		return 0;
 	}
 #endif
@@ -113,6 +141,7 @@ double gl_sensor_get_humi(void)
 	rc = sensor_channel_get(sensor_shtcx, SENSOR_CHAN_HUMIDITY, &humi);
 	if (rc != 0) {
 		printk("SHT3XD: failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, read_err);
 		return 0;
 	}
 #endif
@@ -127,6 +156,7 @@ double gl_sensor_get_light(void)
 	rc = sensor_channel_get(sensor_hx3203, SENSOR_CHAN_LIGHT, &light);
 	if (rc != 0) {
 		printk("sensor_hx3203 failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, read_err);
 		return 0;
 	}
 #endif
@@ -140,6 +170,7 @@ double gl_sensor_get_press(void)
 	rc = sensor_channel_get(sensor_spl0601, SENSOR_CHAN_PRESS, &press);
 	if (rc != 0) {
 		printk("sensor_spl0601 failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, read_err);
 		return 0;
 	}
 #endif
@@ -154,6 +185,7 @@ double gl_sensor_get_temp_spl0601(void)
 	rc = sensor_channel_get(sensor_spl0601, SENSOR_CHAN_AMBIENT_TEMP, &temp);
 	if (rc != 0) {
 		printk("sensor_spl0601: failed: %d\n", rc);
+		STATS_INC(gl_sensor_stats, read_err);
 		return 0;
 	}
 #endif
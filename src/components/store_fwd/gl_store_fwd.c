@@ -0,0 +1,350 @@
+/*****************************************************************************
+ * @file  gl_store_fwd.c
+ * @brief Flash backed queue of samples recorded while detached.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/settings/settings.h>
+
+#include "gl_store_fwd.h"
+#include "gl_coap_utils.h"
+#include "gl_workq.h"
+
+#ifdef CONFIG_GL_STORE_FWD
+
+LOG_MODULE_REGISTER(gl_store_fwd, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+#define STORE_FWD_SETTINGS_ROOT "gl/sf"
+#define STORE_FWD_SETTINGS_BOOT STORE_FWD_SETTINGS_ROOT "/boot"
+
+/* Longest key is "gl/sf/<slot>" */
+#define STORE_FWD_KEY_LEN (sizeof(STORE_FWD_SETTINGS_ROOT) + 4)
+
+/* A batch without any reply after this long is counted as failed */
+#define REPLAY_REPLY_TIMEOUT (2 * COAP_REPLY_TIMEOUT)
+
+enum replay_state {
+	REPLAY_IDLE,
+	REPLAY_PENDING,
+	REPLAY_ACKED,
+	REPLAY_FAILED,
+};
+
+/* Stored in slot seq % CONFIG_GL_STORE_FWD_MAX_RECORDS */
+struct store_fwd_record {
+	uint32_t seq;
+	struct store_fwd_sample sample;
+};
+
+struct store_fwd_load {
+	uint32_t seq;
+	struct store_fwd_sample *sample;
+	bool found;
+};
+
+/* Queue bounds as record sequence numbers, only used from the low priority
+ * work queue once initialized.
+ */
+static uint32_t head_seq;
+static uint32_t tail_seq;
+static bool loaded_any;
+static uint16_t boot;
+
+static store_fwd_send_fn_t send_batch;
+static struct k_work_delayable replay_work;
+static atomic_t replay_state = ATOMIC_INIT(REPLAY_IDLE);
+static uint32_t replay_end_seq;
+static uint16_t replay_failures;
+static struct store_fwd_sample batch[CONFIG_GL_STORE_FWD_BATCH];
+/* Sequence number following each sample of the batch */
+static uint32_t batch_end_seq[CONFIG_GL_STORE_FWD_BATCH];
+
+static void store_fwd_key(char *key, uint32_t seq)
+{
+	snprintf(key, STORE_FWD_KEY_LEN, STORE_FWD_SETTINGS_ROOT "/%u",
+		 (unsigned int)(seq % CONFIG_GL_STORE_FWD_MAX_RECORDS));
+}
+
+static int store_fwd_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+				  void *cb_arg)
+{
+	struct store_fwd_record record;
+	const char *next;
+	char *end;
+	int rc;
+
+	if (settings_name_steq(key, "boot", &next) && !next) {
+		if (len != sizeof(boot)) {
+			return -EINVAL;
+		}
+
+		rc = read_cb(cb_arg, &boot, sizeof(boot));
+		return rc < 0 ? rc : 0;
+	}
+
+	strtoul(key, &end, 10);
+	if (end == key || *end != '\0') {
+		return -ENOENT;
+	}
+
+	if (len != sizeof(record)) {
+		return -EINVAL;
+	}
+
+	rc = read_cb(cb_arg, &record, sizeof(record));
+	if (rc < 0) {
+		return rc;
+	}
+
+	/* Records are written in sequence, the oldest and newest bound the queue */
+	if (!loaded_any || (int32_t)(record.seq - head_seq) < 0) {
+		head_seq = record.seq;
+	}
+	if (!loaded_any || (int32_t)(record.seq - tail_seq) >= 0) {
+		tail_seq = record.seq + 1;
+	}
+	loaded_any = true;
+
+	return 0;
+}
+
+static struct settings_handler store_fwd_settings = {
+	.name = STORE_FWD_SETTINGS_ROOT,
+	.h_set = store_fwd_settings_set,
+};
+
+static int store_fwd_load_cb(const char *key, size_t len, settings_read_cb read_cb,
+			     void *cb_arg, void *param)
+{
+	struct store_fwd_load *load = param;
+	struct store_fwd_record record;
+
+	/* Only the slot itself, not keys below it */
+	if (key != NULL || len != sizeof(record)) {
+		return 0;
+	}
+
+	if (read_cb(cb_arg, &record, sizeof(record)) == sizeof(record) &&
+	    record.seq == load->seq) {
+		*load->sample = record.sample;
+		load->found = true;
+	}
+
+	return 0;
+}
+
+/* Reads up to max samples from the head of the queue. Slots lost to a reset
+ * in the middle of a release are skipped. sample_end_seq receives the
+ * sequence number following each sample, end_seq the one following the
+ * last slot read.
+ */
+static int store_fwd_peek(struct store_fwd_sample *samples, uint32_t *sample_end_seq, int max,
+			  uint32_t *end_seq)
+{
+	char key[STORE_FWD_KEY_LEN];
+	struct store_fwd_load load;
+	uint32_t seq;
+	int count = 0;
+
+	for (seq = head_seq; seq != tail_seq && count < max; seq++) {
+		load.seq = seq;
+		load.sample = &samples[count];
+		load.found = false;
+
+		store_fwd_key(key, seq);
+		settings_load_subtree_direct(key, store_fwd_load_cb, &load);
+		if (load.found) {
+			sample_end_seq[count] = seq + 1;
+			count++;
+		}
+	}
+
+	*end_seq = seq;
+	return count;
+}
+
+static void store_fwd_release(uint32_t end_seq)
+{
+	char key[STORE_FWD_KEY_LEN];
+
+	/* Records overwritten while the batch was in flight are already gone */
+	while ((int32_t)(end_seq - head_seq) > 0) {
+		store_fwd_key(key, head_seq);
+		settings_delete(key);
+		head_seq++;
+	}
+}
+
+static uint32_t replay_backoff_ms(uint16_t failures)
+{
+	uint32_t window = CONFIG_GL_STORE_FWD_BACKOFF_MAX;
+
+	if (failures < 16 && (CONFIG_GL_STORE_FWD_REPLAY_INTERVAL << failures) < window) {
+		window = CONFIG_GL_STORE_FWD_REPLAY_INTERVAL << failures;
+	}
+
+	/* Equal jitter: half of the window is fixed, the other half random */
+	return window / 2 + sys_rand32_get() % (window / 2 + 1);
+}
+
+static void replay_retry(void)
+{
+	replay_failures++;
+	k_work_reschedule_for_queue(&gl_workq_lo, &replay_work,
+				    K_MSEC(replay_backoff_ms(replay_failures)));
+}
+
+static void replay_run(struct k_work *item)
+{
+	int count;
+	int rc;
+
+	ARG_UNUSED(item);
+
+	switch (atomic_set(&replay_state, REPLAY_IDLE)) {
+	case REPLAY_PENDING:
+		LOG_WRN("Replay batch not answered");
+		replay_retry();
+		return;
+	case REPLAY_FAILED:
+		replay_retry();
+		return;
+	case REPLAY_ACKED:
+		store_fwd_release(replay_end_seq);
+		replay_failures = 0;
+		if (head_seq == tail_seq) {
+			LOG_INF("Replay done");
+			return;
+		}
+		/* Rate limit: one batch per interval */
+		k_work_reschedule_for_queue(&gl_workq_lo, &replay_work,
+					    K_MSEC(CONFIG_GL_STORE_FWD_REPLAY_INTERVAL));
+		return;
+	default:
+		break;
+	}
+
+	count = store_fwd_peek(batch, batch_end_seq, ARRAY_SIZE(batch), &replay_end_seq);
+	if (count == 0) {
+		/* Only lost slots left */
+		store_fwd_release(replay_end_seq);
+		return;
+	}
+
+	atomic_set(&replay_state, REPLAY_PENDING);
+
+	rc = send_batch(batch, count);
+	if (rc <= 0) {
+		atomic_set(&replay_state, REPLAY_IDLE);
+		if (rc != -ENOTCONN) {
+			replay_retry();
+		}
+		return;
+	}
+
+	/* The sender may have fit only the first samples into the request */
+	if (rc < count) {
+		replay_end_seq = batch_end_seq[rc - 1];
+	}
+
+	LOG_INF("Replaying %d of %zu samples", rc, store_fwd_count());
+
+	/* Replaced by store_fwd_replay_done() when the reply arrives */
+	k_work_reschedule_for_queue(&gl_workq_lo, &replay_work, K_MSEC(REPLAY_REPLY_TIMEOUT));
+}
+
+void store_fwd_init(store_fwd_send_fn_t send_fn)
+{
+	send_batch = send_fn;
+	k_work_init_delayable(&replay_work, replay_run);
+
+	settings_register(&store_fwd_settings);
+	settings_load_subtree(STORE_FWD_SETTINGS_ROOT);
+
+	boot++;
+	if (settings_save_one(STORE_FWD_SETTINGS_BOOT, &boot, sizeof(boot))) {
+		LOG_WRN("Failed to store boot counter");
+	}
+
+	if (store_fwd_count()) {
+		LOG_INF("%zu stored samples to replay", store_fwd_count());
+	}
+}
+
+int store_fwd_push(struct store_fwd_sample *sample)
+{
+	char key[STORE_FWD_KEY_LEN];
+	struct store_fwd_record record;
+	int rc;
+
+	sample->uptime = k_uptime_get() / MSEC_PER_SEC;
+	sample->boot = boot;
+
+	record.seq = tail_seq;
+	record.sample = *sample;
+
+	/* The oldest record shares the slot and is overwritten */
+	store_fwd_key(key, record.seq);
+	rc = settings_save_one(key, &record, sizeof(record));
+	if (rc) {
+		LOG_ERR("Failed to store sample: %d", rc);
+		return rc;
+	}
+
+	tail_seq++;
+	if (tail_seq - head_seq > CONFIG_GL_STORE_FWD_MAX_RECORDS) {
+		LOG_WRN("Store-and-forward queue full, oldest sample dropped");
+		head_seq = tail_seq - CONFIG_GL_STORE_FWD_MAX_RECORDS;
+	}
+
+	return 0;
+}
+
+void store_fwd_replay_start(void)
+{
+	uint32_t delay_ms = CONFIG_GL_STORE_FWD_REPLAY_DELAY;
+
+	if (delay_ms) {
+		delay_ms += sys_rand32_get() % delay_ms;
+	}
+
+	/* A replay already scheduled, or backing off, keeps its time */
+	k_work_schedule_for_queue(&gl_workq_lo, &replay_work, K_MSEC(delay_ms));
+}
+
+void store_fwd_replay_done(bool acked)
+{
+	if (atomic_cas(&replay_state, REPLAY_PENDING, acked ? REPLAY_ACKED : REPLAY_FAILED)) {
+		k_work_reschedule_for_queue(&gl_workq_lo, &replay_work, K_NO_WAIT);
+	}
+}
+
+size_t store_fwd_count(void)
+{
+	return tail_seq - head_seq;
+}
+
+uint16_t store_fwd_boot(void)
+{
+	return boot;
+}
+
+#endif /* CONFIG_GL_STORE_FWD */
@@ -0,0 +1,91 @@
+/*****************************************************************************
+ * @file  gl_store_fwd.h
+ * @brief The header file of gl_store_fwd.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_STORE_FWD_H_
+#define _GL_STORE_FWD_H_
+
+#include <zephyr/types.h>
+
+/* One status sample recorded while the device was detached */
+struct store_fwd_sample {
+	uint32_t uptime; /* s since boot, set by store_fwd_push() */
+	uint16_t boot; /* boot counter, set by store_fwd_push() */
+	uint8_t battery_level;
+	float temperature;
+	float humidity;
+	float light;
+	float press;
+};
+
+/** @brief Send one replay batch.
+ *
+ * Runs on the low priority work queue. The outcome is reported later with
+ * store_fwd_replay_done(). The sender may send only the first samples when
+ * the whole batch does not fit into one request, the rest follow in the
+ * next batch.
+ *
+ * @return number of samples sent, at least 1, -ENOTCONN to stop the replay
+ *         until the next store_fwd_replay_start(), other negative errno to
+ *         retry later.
+ */
+typedef int (*store_fwd_send_fn_t)(const struct store_fwd_sample *samples, int count);
+
+/** @brief Restore the queue from settings and count this boot.
+ *
+ * Must be called after settings_subsys_init().
+ *
+ * @param[in] send_fn sender of the replay batches.
+ */
+void store_fwd_init(store_fwd_send_fn_t send_fn);
+
+/** @brief Append a sample to the queue, dropping the oldest one when full.
+ *
+ * Must be called from the low priority work queue.
+ *
+ * @param[in] sample sample, uptime and boot are filled in.
+ *
+ * @return 0 on success, negative errno if it could not be stored.
+ */
+int store_fwd_push(struct store_fwd_sample *sample);
+
+/** @brief Start replaying the queue after the device attached.
+ *
+ * The first batch goes out after CONFIG_GL_STORE_FWD_REPLAY_DELAY ms plus a
+ * random part of the same length, so a whole network reattaching does not
+ * replay at once. Does nothing if a replay is already scheduled.
+ */
+void store_fwd_replay_start(void);
+
+/** @brief Report the outcome of the batch sent last.
+ *
+ * May be called from any thread.
+ *
+ * @param[in] acked true if the peer answered the batch.
+ */
+void store_fwd_replay_done(bool acked);
+
+/** @brief Number of samples waiting to be replayed.
+ */
+size_t store_fwd_count(void);
+
+/** @brief Boot counter of the running firmware.
+ */
+uint16_t store_fwd_boot(void);
+
+#endif /* _GL_STORE_FWD_H_ */
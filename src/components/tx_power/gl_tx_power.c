@@ -0,0 +1,224 @@
+/*****************************************************************************
+ * @file  gl_tx_power.c
+ * @brief Closed loop transmit power control.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/openthread.h>
+#include <openthread/thread.h>
+#include <openthread/link.h>
+#include <openthread/platform/radio.h>
+#ifdef CONFIG_OPENTHREAD_FTD
+#include <openthread/thread_ftd.h>
+#endif
+
+#include "gl_tx_power.h"
+#include "gl_workq.h"
+
+LOG_MODULE_REGISTER(gl_tx_power, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
+
+/* Retry ratios in percent of transmitted frames */
+#define RETRY_RATIO_HIGH 25
+#define RETRY_RATIO_LOW 5
+
+/* Do not judge the link on fewer frames than this */
+#define MIN_TX_FRAMES 4
+
+BUILD_ASSERT(CONFIG_GL_TX_POWER_MIN <= CONFIG_GL_TX_POWER_MAX,
+	     "CONFIG_GL_TX_POWER_MIN above CONFIG_GL_TX_POWER_MAX");
+
+static bool pinned;
+static int8_t tx_power = CONFIG_GL_TX_POWER_MAX;
+
+#ifdef CONFIG_GL_TX_POWER_CTRL
+static struct k_work_delayable tx_power_work;
+static uint32_t last_tx_total;
+static uint32_t last_tx_retry;
+#endif
+
+static int8_t tx_power_clamp(int dbm)
+{
+	return CLAMP(dbm, CONFIG_GL_TX_POWER_MIN, CONFIG_GL_TX_POWER_MAX);
+}
+
+static void tx_power_apply(otInstance *instance, int8_t dbm)
+{
+	otError error = otPlatRadioSetTransmitPower(instance, dbm);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to set tx power %ddBm, error: %d", dbm, error);
+		return;
+	}
+
+	tx_power = dbm;
+}
+
+#ifdef CONFIG_GL_TX_POWER_CTRL
+static void tx_power_rssi_min(int8_t avg_rssi, int8_t *rssi, bool *found)
+{
+	if (avg_rssi == OT_RADIO_RSSI_INVALID) {
+		return;
+	}
+
+	if (!*found || avg_rssi < *rssi) {
+		*rssi = avg_rssi;
+		*found = true;
+	}
+}
+
+/* Weakest average RSSI towards the parent, or towards any router neighbor or
+ * child when this device routes itself, so sleepy children are not stranded.
+ */
+static bool tx_power_link_rssi(otInstance *instance, int8_t *rssi)
+{
+	otNeighborInfoIterator iterator = OT_NEIGHBOR_INFO_ITERATOR_INIT;
+	otNeighborInfo neighbor;
+	bool found = false;
+
+	switch (otThreadGetDeviceRole(instance)) {
+	case OT_DEVICE_ROLE_CHILD:
+		return otThreadGetParentAverageRssi(instance, rssi) == OT_ERROR_NONE;
+	case OT_DEVICE_ROLE_ROUTER:
+	case OT_DEVICE_ROLE_LEADER:
+		while (otThreadGetNextNeighborInfo(instance, &iterator, &neighbor) ==
+		       OT_ERROR_NONE) {
+			/* Children are taken from the child table below */
+			if (!neighbor.mIsChild) {
+				tx_power_rssi_min(neighbor.mAverageRssi, rssi, &found);
+			}
+		}
+#ifdef CONFIG_OPENTHREAD_FTD
+		otChildInfo child_info;
+
+		for (uint16_t i = 0; i < otThreadGetMaxAllowedChildren(instance); i++) {
+			if (otThreadGetChildInfoByIndex(instance, i, &child_info) ==
+			    OT_ERROR_NONE) {
+				tx_power_rssi_min(child_info.mAverageRssi, rssi, &found);
+			}
+		}
+#endif
+		return found;
+	default:
+		return false;
+	}
+}
+
+static void tx_power_ctrl_update(struct k_work *item)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	const otMacCounters *counters;
+	uint32_t tx_total, tx_retry;
+	int8_t rssi = 0;
+	int margin;
+	int8_t next = tx_power;
+
+	ARG_UNUSED(item);
+
+	openthread_api_mutex_lock(context);
+
+	if (pinned) {
+		goto end;
+	}
+
+	counters = otLinkGetCounters(context->instance);
+	tx_total = counters->mTxTotal - last_tx_total;
+	tx_retry = counters->mTxRetry - last_tx_retry;
+	last_tx_total = counters->mTxTotal;
+	last_tx_retry = counters->mTxRetry;
+
+	if (!tx_power_link_rssi(context->instance, &rssi)) {
+		/* Detached or no neighbors yet, give the attach every chance */
+		next = CONFIG_GL_TX_POWER_MAX;
+	} else {
+		margin = rssi - otPlatRadioGetReceiveSensitivity(context->instance);
+
+		if (margin < CONFIG_GL_TX_POWER_MARGIN_LOW ||
+		    (tx_total >= MIN_TX_FRAMES && tx_retry * 100 > tx_total * RETRY_RATIO_HIGH)) {
+			next = tx_power_clamp(tx_power + CONFIG_GL_TX_POWER_STEP);
+		} else if (margin > CONFIG_GL_TX_POWER_MARGIN_HIGH &&
+			   tx_retry * 100 <= tx_total * RETRY_RATIO_LOW) {
+			next = tx_power_clamp(tx_power - CONFIG_GL_TX_POWER_STEP);
+		}
+
+		LOG_DBG("margin=%ddB, retry=%u/%u, txpower=%ddBm", margin, tx_retry, tx_total,
+			tx_power);
+	}
+
+	if (next != tx_power) {
+		LOG_INF("TX power %ddBm -> %ddBm", tx_power, next);
+		tx_power_apply(context->instance, next);
+	}
+
+end:
+	openthread_api_mutex_unlock(context);
+
+	k_work_reschedule_for_queue(&gl_workq_lo, &tx_power_work,
+				    K_SECONDS(CONFIG_GL_TX_POWER_CTRL_PERIOD));
+}
+#endif
+
+void tx_power_ctrl_init(void)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(context);
+	tx_power_apply(context->instance, CONFIG_GL_TX_POWER_MAX);
+	openthread_api_mutex_unlock(context);
+
+#ifdef CONFIG_GL_TX_POWER_CTRL
+	k_work_init_delayable(&tx_power_work, tx_power_ctrl_update);
+	k_work_schedule_for_queue(&gl_workq_lo, &tx_power_work,
+				  K_SECONDS(CONFIG_GL_TX_POWER_CTRL_PERIOD));
+#endif
+}
+
+int tx_power_ctrl_pin(int dbm)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(context);
+	pinned = true;
+	tx_power_apply(context->instance, tx_power_clamp(dbm));
+	openthread_api_mutex_unlock(context);
+
+	LOG_INF("TX power pinned to %ddBm", tx_power);
+
+	return tx_power;
+}
+
+void tx_power_ctrl_release(void)
+{
+	pinned = false;
+
+	LOG_INF("TX power control released");
+
+#ifdef CONFIG_GL_TX_POWER_CTRL
+	k_work_reschedule_for_queue(&gl_workq_lo, &tx_power_work, K_NO_WAIT);
+#else
+	struct openthread_context *context = openthread_get_default_context();
+
+	openthread_api_mutex_lock(context);
+	tx_power_apply(context->instance, CONFIG_GL_TX_POWER_MAX);
+	openthread_api_mutex_unlock(context);
+#endif
+}
+
+bool tx_power_ctrl_is_pinned(void)
+{
+	return pinned;
+}
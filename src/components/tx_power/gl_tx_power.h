@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * @file  gl_tx_power.h
+ * @brief The header file of gl_tx_power.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_TX_POWER_H_
+#define _GL_TX_POWER_H_
+
+#include <zephyr/types.h>
+
+/** @brief Set the initial transmit power and start the power control loop.
+ *
+ * The radio starts at CONFIG_GL_TX_POWER_MAX. With CONFIG_GL_TX_POWER_CTRL
+ * the power is then periodically stepped between CONFIG_GL_TX_POWER_MIN and
+ * CONFIG_GL_TX_POWER_MAX based on the link margin and MAC retry rate.
+ */
+void tx_power_ctrl_init(void);
+
+/** @brief Pin the transmit power and suspend the control loop.
+ *
+ * @param[in] dbm requested power, clamped to the configured bounds.
+ *
+ * @return the power that has been applied.
+ */
+int tx_power_ctrl_pin(int dbm);
+
+/** @brief Release a pinned transmit power and resume the control loop.
+ */
+void tx_power_ctrl_release(void);
+
+bool tx_power_ctrl_is_pinned(void);
+
+#endif /* _GL_TX_POWER_H_ */
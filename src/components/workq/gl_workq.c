@@ -0,0 +1,51 @@
+/*****************************************************************************
+ * @file  gl_workq.c
+ * @brief Application work queues.
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#include <zephyr/kernel.h>
+#include <zephyr/init.h>
+
+#include "gl_workq.h"
+
+K_THREAD_STACK_DEFINE(workq_hi_stack, CONFIG_GL_WORKQ_HI_STACK_SIZE);
+K_THREAD_STACK_DEFINE(workq_lo_stack, CONFIG_GL_WORKQ_LO_STACK_SIZE);
+
+struct k_work_q gl_workq_hi;
+struct k_work_q gl_workq_lo;
+
+static int workq_setup(const struct device *arg)
+{
+	const struct k_work_queue_config hi_cfg = {
+		.name = "gl_workq_hi",
+	};
+	const struct k_work_queue_config lo_cfg = {
+		.name = "gl_workq_lo",
+	};
+
+	ARG_UNUSED(arg);
+
+	k_work_queue_start(&gl_workq_hi, workq_hi_stack, K_THREAD_STACK_SIZEOF(workq_hi_stack),
+			   CONFIG_GL_WORKQ_HI_PRIORITY, &hi_cfg);
+	k_work_queue_start(&gl_workq_lo, workq_lo_stack, K_THREAD_STACK_SIZEOF(workq_lo_stack),
+			   CONFIG_GL_WORKQ_LO_PRIORITY, &lo_cfg);
+
+	return 0;
+}
+
+/* Started before main() so every module can submit work from its init */
+SYS_INIT(workq_setup, APPLICATION, CONFIG_APPLICATION_INIT_PRIORITY);
@@ -0,0 +1,35 @@
+/*****************************************************************************
+ * @file  gl_workq.h
+ * @brief The header file of gl_workq.c
+ *******************************************************************************
+ Copyright 2022 GL-iNet. https://www.gl-inet.com/
+
+ Licensed under the Apache License, Version 2.0 (the "License");
+ you may not use this file except in compliance with the License.
+ You may obtain a copy of the License at
+
+ http://www.apache.org/licenses/LICENSE-2.0
+
+ Unless required by applicable law or agreed to in writing, software
+ distributed under the License is distributed on an "AS IS" BASIS,
+ WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ See the License for the specific language governing permissions and
+ limitations under the License.
+ ******************************************************************************/
+
+#ifndef _GL_WORKQ_H_
+#define _GL_WORKQ_H_
+
+#include <zephyr/kernel.h>
+
+/* Button, knob, LED and connection state work. Kept short so that user
+ * input is handled quickly no matter how much telemetry is pending.
+ */
+extern struct k_work_q gl_workq_hi;
+
+/* Reports, provisioning and link maintenance. May block on the radio,
+ * the sensors or flash.
+ */
+extern struct k_work_q gl_workq_lo;
+
+#endif /* _GL_WORKQ_H_ */
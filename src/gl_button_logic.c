@@ -30,6 +30,7 @@
 #include "gl_coap.h"
 #include "gl_ot_api.h"
 #include "gl_srp_utils.h"
+#include "gl_joiner.h"
 
 LOG_MODULE_REGISTER(button_logic, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
 
@@ -39,8 +40,18 @@ const struct gpio_dt_spec SW1 = GPIO_DT_SPEC_GET_OR(SW0_NODE, gpios, { 0 });
 const struct gpio_dt_spec SW2 = GPIO_DT_SPEC_GET_OR(SW1_NODE, gpios, { 0 });
 
 extern int joiner_state;
-uint32_t join_time_start;
 
+void join_network_start(bool user_request)
+{
+	if (joiner_state != DEVICE_CONNECTED) {
+		joiner_sched_session_start(user_request);
+		if (ot_start() == 0) {
+			joiner_state = DEVICE_CONNECTING;
+			led_toggle_start(200);
+			LOG_INF("Joining start...");
+		}
+	}
+}
 
 void on_button_changed(uint32_t button_state, uint32_t has_changed)
 {
@@ -92,14 +103,7 @@ void on_button_changed(uint32_t button_state, uint32_t has_changed)
 	}else if (is_sw2_press && is_sw2_release) {
 		printk("Button2\n");
 		if ((sw2_time_end - sw2_time_start) < 300) { // Joining
-			join_time_start = k_uptime_get_32();
-			if (joiner_state != DEVICE_CONNECTED) {
-				if (ot_start() == 0) {
-					joiner_state = DEVICE_CONNECTING;
-					led_toggle_start(200);
-					LOG_INF("Joining start...");
-				}
-			}
+			join_network_start(true);
 			is_sw2_press = false;
 			is_sw2_release = false;
 		} else if ((sw2_time_end - sw2_time_start) > 3000) { // Factoryreset
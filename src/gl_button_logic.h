@@ -20,10 +20,18 @@
 #ifndef _GL_BUTTON_H_
 #define _GL_BUTTON_H_
 
+#include <stdbool.h>
 #include <zephyr/types.h>
 
 
 void on_button_changed(uint32_t button_state, uint32_t has_changed);
 
+/** @brief Start joining a Thread network.
+ *
+ * @param[in] user_request true when requested by the user, which grants a
+ *                         fresh joiner retry budget.
+ */
+void join_network_start(bool user_request);
+
 
 #endif /* _GL_BUTTON_H_ */
\ No newline at end of file
@@ -21,10 +21,12 @@
 #include <string.h>
 #include <zephyr/sys/reboot.h>
 #include <zephyr/kernel.h>
-#include <net/coap_utils.h>
 #include <zephyr/logging/log.h>
 #include <zephyr/net/openthread.h>
 #include <zephyr/net/socket.h>
+#include <zephyr/settings/settings.h>
+#include <zephyr/random/rand32.h>
+#include <zephyr/stats/stats.h>
 #include <openthread/thread.h>
 #include <openthread/message.h>
 #include <openthread/coap.h>
@@ -33,6 +35,11 @@
 
 #include "gl_cjson_utils.h"
 #include "gl_coap.h"
+#include "gl_coap_utils.h"
+#include "gl_coap_observe.h"
+#include "gl_coap_block.h"
+#include "gl_coap_dedup.h"
+#include "gl_coap_exec.h"
 #include "gl_srp_utils.h"
 #include "gl_types.h"
 #include "gl_ot_api.h"
@@ -41,41 +48,100 @@
 #include "gl_led_strip.h"
 #include "gl_gpio.h"
 #include "gl_battery.h"
+#include "gl_poll_ctrl.h"
+#include "gl_tx_power.h"
+#include "gl_joiner.h"
+#include "gl_workq.h"
+#include "gl_sched_action.h"
+#include "gl_lookup.h"
+#ifdef CONFIG_GL_DNSSD_DISCOVERY
+#include "gl_dnssd.h"
+#endif
+#ifdef CONFIG_GL_SENML_REPORT
+#include "gl_senml.h"
+#endif
+#ifdef CONFIG_GL_STORE_FWD
+#include "gl_store_fwd.h"
+#endif
+#ifdef CONFIG_GL_RULES
+#include "gl_rules.h"
+#endif
+#ifdef CONFIG_GL_PERSIST
+#include "gl_persist.h"
+#endif
 
 LOG_MODULE_REGISTER(gl_coap, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
 
-#define RESPONSE_POLL_PERIOD 100
+/* One counter per cmd, "gl_cmd" group of mcumgr stat */
+STATS_SECT_START(gl_cmd_stats)
+STATS_SECT_ENTRY32(onoff)
+STATS_SECT_ENTRY32(upgrade)
+STATS_SECT_ENTRY32(factoryreset)
+STATS_SECT_ENTRY32(reboot)
+STATS_SECT_ENTRY32(change_color)
+STATS_SECT_ENTRY32(set_gpio)
+STATS_SECT_ENTRY32(get_led_status)
+STATS_SECT_ENTRY32(get_gpio_status)
+STATS_SECT_ENTRY32(set_report_interval)
+STATS_SECT_ENTRY32(set_ot_mode)
+STATS_SECT_ENTRY32(set_tx_power)
+STATS_SECT_ENTRY32(set_rules)
+STATS_SECT_ENTRY32(unknown)
+STATS_SECT_ENTRY32(failed)
+STATS_SECT_END;
+
+STATS_NAME_START(gl_cmd_stats)
+STATS_NAME(gl_cmd_stats, onoff)
+STATS_NAME(gl_cmd_stats, upgrade)
+STATS_NAME(gl_cmd_stats, factoryreset)
+STATS_NAME(gl_cmd_stats, reboot)
+STATS_NAME(gl_cmd_stats, change_color)
+STATS_NAME(gl_cmd_stats, set_gpio)
+STATS_NAME(gl_cmd_stats, get_led_status)
+STATS_NAME(gl_cmd_stats, get_gpio_status)
+STATS_NAME(gl_cmd_stats, set_report_interval)
+STATS_NAME(gl_cmd_stats, set_ot_mode)
+STATS_NAME(gl_cmd_stats, set_tx_power)
+STATS_NAME(gl_cmd_stats, set_rules)
+STATS_NAME(gl_cmd_stats, unknown)
+STATS_NAME(gl_cmd_stats, failed)
+STATS_NAME_END(gl_cmd_stats);
+
+static STATS_SECT_DECL(gl_cmd_stats) gl_cmd_stats;
+
+/* Uplink reports, "gl_report" group of mcumgr stat */
+STATS_SECT_START(gl_report_stats)
+STATS_SECT_ENTRY32(provisioning)
+STATS_SECT_ENTRY32(provisioned)
+STATS_SECT_ENTRY32(peer_lost)
+STATS_SECT_ENTRY32(status)
+STATS_SECT_ENTRY32(status_skip)
+STATS_SECT_ENTRY32(trigger)
+STATS_SECT_ENTRY32(trigger_skip)
+STATS_SECT_ENTRY32(senml)
+STATS_SECT_ENTRY32(history)
+STATS_SECT_ENTRY32(stored)
+STATS_SECT_END;
+
+STATS_NAME_START(gl_report_stats)
+STATS_NAME(gl_report_stats, provisioning)
+STATS_NAME(gl_report_stats, provisioned)
+STATS_NAME(gl_report_stats, peer_lost)
+STATS_NAME(gl_report_stats, status)
+STATS_NAME(gl_report_stats, status_skip)
+STATS_NAME(gl_report_stats, trigger)
+STATS_NAME(gl_report_stats, trigger_skip)
+STATS_NAME(gl_report_stats, senml)
+STATS_NAME(gl_report_stats, history)
+STATS_NAME(gl_report_stats, stored)
+STATS_NAME_END(gl_report_stats);
+
+static STATS_SECT_DECL(gl_report_stats) gl_report_stats;
+
+#define CONN_EVENT_QUEUE_SIZE 8
 
 #define CONFIG_DEFAULT_REPORT_AFTER (1 * 60 * 1000)
 #define CONFIG_DEFAULT_REPORT_REPEAT (5 * 60 * 1000)
-#define JOIN_COMMISSIONING_TIMEOUT	(3 * 60 * 1000)
-
-struct _cmd_s {
-	int id;
-	char cmd[64];
-} g_cmd[] = {
-	{ CONFIG_CMD_ON_OFF, "onoff" },
-	{ CONFIG_CMD_UPGRADE, "upgrade" },
-	{ CONFIG_CMD_FACTORYRESET, "factoryreset" },
-	{ CONFIG_CMD_REBOOT, "reboot" },
-	{ CONFIG_CMD_CHANGE_COLOR, "change_color" },
-	{ CONFIG_CMD_SET_GPIO, "set_gpio" },
-	{ CONFIG_CMD_GET_GPIO_STATUS, "get_gpio_status" },
-	{ CONFIG_CMD_GET_LED_STATUS, "get_led_status" },
-	{ CONFIG_CMD_SET_REPORT_INTERVAL, "set_report_interval" },
-	{ CONFIG_CMD_SET_OT_MODE, "set_ot_mode"},
-};
-
-struct _obj_s {
-	int id;
-	char obj[64];
-} g_led_obj[] = {
-	{ CONFIG_OBJ_LED_STRIP_NODE_ALL, "all" },
-	{ CONFIG_OBJ_LED_STRIP_NODE_LEFT, "led_left" },
-	{ CONFIG_OBJ_LED_STRIP_NODE_RIGHT, "led_right" },
-};
-
-static uint32_t poll_period;
 
 static bool is_joined;
 static bool is_connected;
@@ -84,25 +150,20 @@ static bool is_srp_client_running = false;
 static struct k_work multicast_light_work;
 static struct k_work toggle_MTD_SED_work;
 static struct k_work provisioning_work;
+static struct k_work provisioning_multicast_work;
 static struct k_work on_connect_work;
 static struct k_work on_disconnect_work;
 static struct k_work report_status_work;
-static struct k_work factory_reset_work;
+#ifdef CONFIG_GL_SENML_REPORT
+static struct k_work report_senml_work;
+#endif
 // static struct k_timer factory_reset_timer;
 
 static struct k_timer report_timer;
 
 mtd_mode_toggle_cb_t on_mtd_mode_toggle;
-extern uint32_t join_time_start;
 int report_interval_second = CONFIG_DEFAULT_REPORT_REPEAT/1000;  //millisecond to second
 
-/* Options supported by the server */
-static const char *const provisioning_option[] = { PROVISIONING_URI_PATH, NULL };
-static const char *const status_option[] = { STATUS_URI_PATH, NULL };
-static const char *const trigger_repo_option[] = { TRIGGER_REPO_URI_PATH, NULL };
-
-static const char *const testing_light_option[] = { TESTING_LIGHT_URI_PATH, NULL };
-
 struct server_context {
 	struct otInstance *ot;
 	cmd_request_callback_t cmd_request;
@@ -121,6 +182,16 @@ static otCoapResource cmd_resource = {
 	.mNext = NULL,
 };
 
+#ifdef CONFIG_GL_COAP_OBSERVE
+/**@brief Definition of the observable status resource. */
+static otCoapResource status_resource = {
+	.mUriPath = STATUS_URI_PATH,
+	.mHandler = NULL,
+	.mContext = NULL,
+	.mNext = NULL,
+};
+#endif
+
 /**@brief Definition of CoAP resources for testing mode. */
 static otCoapResource testing_light_resource = {
 	.mUriPath = TESTING_LIGHT_URI_PATH,
@@ -194,6 +265,11 @@ static void testing_light_request_handler(void *context, otMessage *message,
 		LOG_ERR("Testing Light handler - Unexpected CoAP code");
 		return;
 	}
+
+	if (coap_dedup_check(message, message_info)) {
+		return;
+	}
+	coap_dedup_accept(message, message_info);
 	length = otMessageRead(message, otMessageGetOffset(message), buf, sizeof(buf) - 1);
 	buf[length] = '\0';
 
@@ -219,11 +295,16 @@ static void testing_light_request_handler(void *context, otMessage *message,
 	free(resp);
 	cJSON_Delete(resp_obj);
 */
+	/* OpenThread thread: never wait for the arena, the worker holding it may
+	 * be waiting for the OpenThread API mutex.
+	 */
+	gl_json_arena_begin(K_NO_WAIT);
+
 	cJSON *root_obj = NULL;
 	root_obj = cJSON_Parse(buf);
 	if (root_obj == NULL) {
 		LOG_ERR("cJSON Parse failure");
-		return;
+		goto end;
 	}
 
 	cJSON* event_obj = cJSON_GetObjectItem(root_obj, "event");
@@ -232,13 +313,14 @@ static void testing_light_request_handler(void *context, otMessage *message,
 	if(trigger_type == NULL)
 	{
 		LOG_ERR("get trigger_type failure");
-		return;
+		goto end;
 	}
 
-	if(0 == strcmp(trigger_type, "qdec_button"))
-	{
+	switch (gl_lookup_find(&gl_lookup_trigger, trigger_type)) {
+	case QDEC_BUTTON_TRIGGER:
 		on_off_led_strip(ALL_LED_NODE, LED_TOGGLE);
-	}else if(0 == strcmp(trigger_type, "qdec_rotate")) {
+		break;
+	case QDEC_ROTATE_TRIGGER:
 		// if(0 > gl_json_get_int(event_obj, "value"))
 		// {
 			
@@ -246,161 +328,316 @@ static void testing_light_request_handler(void *context, otMessage *message,
 
 		// }
 		update_led_strip_rgb_to_next();
+		break;
+	default:
+		break;
 	}
 
-	return;
+end:
+	cJSON_Delete(root_obj);
+	gl_json_arena_end();
 }
 
-/********************************************************************************************/
-#if 0
-static bool check_cmd_valid(const char *cmd)
+/********************************************************************************************
+ * 									Report Scheduling
+********************************************************************************************/
+#define REPORT_START_DELAY 3000
+
+/* Nominal time of the next report, the actual expiry adds jitter on top */
+static int64_t report_deadline;
+static uint32_t report_rand_state;
+
+/* Cheap PRNG, the timer expiry runs in ISR context where the entropy
+ * driver can not be used.
+ */
+static uint32_t report_rand(void)
 {
-	if (!cmd)
-		return false;
+	report_rand_state ^= report_rand_state << 13;
+	report_rand_state ^= report_rand_state >> 17;
+	report_rand_state ^= report_rand_state << 5;
 
-	for (int i = 0; i < ARRAY_SIZE(g_cmd); i++) {
-		if (!strcmp(g_cmd[i].cmd, cmd))
-			return true;
+	return report_rand_state;
+}
+
+/* Per-device phase offset within the report interval, derived from the EUI64
+ * so that nodes re-registering together still report spread out.
+ */
+static uint64_t report_phase_ms(uint64_t interval_ms)
+{
+	uint32_t hash = 2166136261u; /* FNV-1a */
+
+	for (const char *p = ot_get_eui64(); *p; p++) {
+		hash = (hash ^ (uint8_t)*p) * 16777619u;
 	}
-	return false;
+
+	return hash % interval_ms;
 }
-#endif
 
-void do_after_srp_srv_reg(void);
+BUILD_ASSERT(CONFIG_DEFAULT_REPORT_REPEAT / 1000 <= CONFIG_GL_REPORT_INTERVAL_MAX,
+	     "Default report interval above CONFIG_GL_REPORT_INTERVAL_MAX");
 
-static int get_cmd_id(const char *cmd)
+static bool report_interval_valid(int seconds)
 {
-	if (!cmd)
-		return -1;
+	return seconds > 0 && seconds <= CONFIG_GL_REPORT_INTERVAL_MAX;
+}
+
+static uint64_t report_interval_ms(void)
+{
+	return (uint64_t)report_interval_second * MSEC_PER_SEC;
+}
 
-	for (int i = 0; i < ARRAY_SIZE(g_cmd); i++) {
-		if (!strcmp(g_cmd[i].cmd, cmd))
-			return g_cmd[i].id;
+static k_timeout_t report_next_delay(void)
+{
+	uint64_t jitter_ms = report_interval_ms() / 100 * CONFIG_GL_REPORT_JITTER_PERCENT;
+	int64_t next = report_deadline;
+
+	if (jitter_ms) {
+		next += (int64_t)(report_rand() % (2 * jitter_ms + 1)) - (int64_t)jitter_ms;
 	}
 
-	return -1;
+	next -= k_uptime_get();
+
+	return next > 0 ? K_MSEC(next) : K_NO_WAIT;
 }
 
-static bool check_obj_valid(const char *obj)
+static void report_timer_start(void)
 {
-	if (!obj)
-		return false;
+	uint64_t interval_ms = report_interval_ms();
 
-	for (int i = 0; i < ARRAY_SIZE(g_led_obj); i++) {
-		if (!strcmp(g_led_obj[i].obj, obj))
-			return true;
+	if (!report_rand_state) {
+		report_rand_state = sys_rand32_get() | 1;
 	}
-	return false;
+
+	report_deadline = k_uptime_get() + REPORT_START_DELAY + (int64_t)report_phase_ms(interval_ms);
+
+	k_timer_stop(&report_timer);
+	k_timer_start(&report_timer, report_next_delay(), K_NO_WAIT);
 }
 
-static bool is_mtd_in_med_mode(otInstance *instance)
+/********************************************************************************************/
+void do_after_srp_srv_reg(void);
+
+static int get_cmd_id(const char *cmd)
 {
-	return otThreadGetLinkMode(instance).mRxOnWhenIdle;
+	return gl_lookup_find(&gl_lookup_cmd, cmd);
 }
 
-static void poll_period_response_set(void)
+static int get_led_obj_id(const char *obj)
 {
-	otError error;
-
-	otInstance *instance = openthread_get_default_instance();
+	return gl_lookup_find(&gl_lookup_led_obj, obj);
+}
 
-	if (is_mtd_in_med_mode(instance)) {
-		return;
-	}
+#define PEER_SETTINGS_ROOT "gl/peer"
+#define PEER_SETTINGS_ADDR PEER_SETTINGS_ROOT "/addr"
+#define PEER_SETTINGS_PORT PEER_SETTINGS_ROOT "/port"
 
-	if (!poll_period) {
-		poll_period = otLinkGetPollPeriod(instance);
+/* Requests sent to the peer that have not been answered yet */
+static atomic_t peer_unanswered;
 
-		error = otLinkSetPollPeriod(instance, RESPONSE_POLL_PERIOD);
-		__ASSERT(error == OT_ERROR_NONE, "Failed to set pool period");
+/* Counts a request to the peer before it is sent, so a fast reply can not
+ * clear the count ahead of it. Takes it back when no reply can ever come.
+ */
+static void peer_request_begin(void)
+{
+	atomic_inc(&peer_unanswered);
+}
 
-		LOG_INF("Poll Period: %dms set", RESPONSE_POLL_PERIOD);
+static void peer_request_end(int rc)
+{
+	if (rc != 0 && atomic_get(&peer_unanswered) > 0) {
+		atomic_dec(&peer_unanswered);
 	}
 }
 
-static void poll_period_restore(void)
+/* Peer to be stored and the peer in settings. The update comes from
+ * OpenThread callbacks, the flash write is done on the low priority queue.
+ */
+static struct k_spinlock peer_store_lock;
+static struct in6_addr peer_store_addr;
+static uint16_t peer_store_port;
+static struct in6_addr peer_stored_addr;
+static uint16_t peer_stored_port;
+static struct k_work peer_store_work;
+
+static void peer_store(struct k_work *item)
 {
-	otError error;
-	otInstance *instance = openthread_get_default_instance();
+	struct in6_addr addr;
+	uint16_t port;
+	k_spinlock_key_t key;
+
+	ARG_UNUSED(item);
+
+	key = k_spin_lock(&peer_store_lock);
+	addr = peer_store_addr;
+	port = peer_store_port;
+	k_spin_unlock(&peer_store_lock, key);
 
-	if (is_mtd_in_med_mode(instance)) {
+	if (!memcmp(&addr, &peer_stored_addr, sizeof(addr)) && port == peer_stored_port) {
 		return;
 	}
 
-	if (poll_period) {
-		error = otLinkSetPollPeriod(instance, poll_period);
-		__ASSERT_NO_MSG(error == OT_ERROR_NONE);
-
-		LOG_INF("Poll Period: %dms restored", poll_period);
-		poll_period = 0;
+	if (net_ipv6_is_addr_unspecified(&addr)) {
+		settings_delete(PEER_SETTINGS_ADDR);
+		settings_delete(PEER_SETTINGS_PORT);
+	} else if (settings_save_one(PEER_SETTINGS_ADDR, &addr, sizeof(addr)) ||
+		   settings_save_one(PEER_SETTINGS_PORT, &port, sizeof(port))) {
+		LOG_WRN("Failed to store peer address");
+		return;
 	}
+
+	peer_stored_addr = addr;
+	peer_stored_port = port;
 }
 
-static void initial_unique_local_addr(void)
+static void peer_store_schedule(const struct in6_addr *addr, uint16_t port)
 {
-	struct otInstance *instance = openthread_get_default_instance();
-	const otSockAddr *serverSockAddr = otSrpClientGetServerAddress(instance);
-	memcpy(&unique_local_addr.sin6_addr, &serverSockAddr->mAddress, sizeof(unique_local_addr.sin6_addr));
+	k_spinlock_key_t key = k_spin_lock(&peer_store_lock);
 
-	inet_ntop(AF_INET6, &(unique_local_addr.sin6_addr), unique_local_addr_str, INET6_ADDRSTRLEN);
+	peer_store_addr = *addr;
+	peer_store_port = port;
+	k_spin_unlock(&peer_store_lock, key);
+
+	k_work_submit_to_queue(&gl_workq_lo, &peer_store_work);
 }
 
-static int on_provisioning_reply(const struct coap_packet *response, struct coap_reply *reply,
-				 const struct sockaddr *from)
+static bool peer_addr_is_set(void)
 {
-	int ret = 0;
-	const uint8_t *payload;
-	uint16_t payload_size = 0u;
+	return unique_local_addr.sin6_addr.s6_addr16[0] != 0;
+}
+
+static void peer_addr_update(const struct in6_addr *addr, uint16_t port, bool store)
+{
+	memcpy(&unique_local_addr.sin6_addr, addr, sizeof(unique_local_addr.sin6_addr));
+	unique_local_addr.sin6_port = htons(port);
+	inet_ntop(AF_INET6, &unique_local_addr.sin6_addr, unique_local_addr_str, INET6_ADDRSTRLEN);
+	atomic_clear(&peer_unanswered);
 
-	ARG_UNUSED(reply);
-	ARG_UNUSED(from);
+	if (store) {
+		peer_store_schedule(addr, port);
+	}
+}
 
-	payload = coap_packet_get_payload(response, &payload_size);
+static void peer_addr_invalidate(void)
+{
+	LOG_WRN("Peer %s does not answer, provisioning again", unique_local_addr_str);
 
-	if (payload == NULL || payload_size != sizeof(unique_local_addr.sin6_addr)) {
-		LOG_ERR("Received data is invalid");
-		ret = -EINVAL;
-		goto exit;
+#ifdef CONFIG_GL_DNSSD_DISCOVERY
+	dnssd_server_failed((const otIp6Address *)&unique_local_addr.sin6_addr);
+#endif
+	memset(&unique_local_addr.sin6_addr, 0, sizeof(unique_local_addr.sin6_addr));
+	unique_local_addr_str[0] = '\0';
+	atomic_clear(&peer_unanswered);
+	peer_store_schedule(&unique_local_addr.sin6_addr, 0);
+}
+
+/* The stored peer is trusted until it stops answering. Returns false and
+ * starts provisioning when there is no usable peer.
+ */
+static bool peer_addr_check(void)
+{
+	if (peer_addr_is_set() && CONFIG_GL_PEER_MAX_UNANSWERED > 0 &&
+	    atomic_get(&peer_unanswered) >= CONFIG_GL_PEER_MAX_UNANSWERED) {
+		STATS_INC(gl_report_stats, peer_lost);
+		peer_addr_invalidate();
+	}
+
+	if (!peer_addr_is_set()) {
+		LOG_WRN("Peer address not set");
+		coap_client_send_provisioning_request();
+		return false;
 	}
 
-	memcpy(&unique_local_addr.sin6_addr, payload, payload_size);
+	return true;
+}
+
+static int peer_settings_set(const char *key, size_t len, settings_read_cb read_cb,
+			     void *cb_arg)
+{
+	struct in6_addr addr;
+	uint16_t port;
+	const char *next;
+	int rc;
+
+	if (settings_name_steq(key, "addr", &next) && !next) {
+		if (len != sizeof(addr)) {
+			return -EINVAL;
+		}
 
-	if (!inet_ntop(AF_INET6, payload, unique_local_addr_str, INET6_ADDRSTRLEN)) {
-		LOG_ERR("Received data is not IPv6 address: %d", errno);
-		ret = -errno;
-		goto exit;
+		rc = read_cb(cb_arg, &addr, sizeof(addr));
+		if (rc < 0) {
+			return rc;
+		}
+
+		peer_addr_update(&addr, ntohs(unique_local_addr.sin6_port), false);
+		peer_stored_addr = addr;
+		peer_store_addr = addr;
+		LOG_INF("Restored peer address: %s", unique_local_addr_str);
+		return 0;
 	}
 
-	LOG_INF("Received peer address: %s", unique_local_addr_str);
+	if (settings_name_steq(key, "port", &next) && !next) {
+		if (len != sizeof(port)) {
+			return -EINVAL;
+		}
 
-	coap_client_send_status();
+		rc = read_cb(cb_arg, &port, sizeof(port));
+		if (rc < 0) {
+			return rc;
+		}
 
-exit:
-	if (IS_ENABLED(CONFIG_OPENTHREAD_MTD_SED)) {
-		poll_period_restore();
+		unique_local_addr.sin6_port = htons(port);
+		peer_stored_port = port;
+		peer_store_port = port;
+		return 0;
 	}
 
-	return ret;
+	return -ENOENT;
 }
 
-struct trigger{
-	trigger_event_type_e 	event_id;
-	char*					event_name[64];
-} g_trigger_event[] = {
-	{INFRARED_SENSOR_TRIGGER, "infrared_sensor"},
-	{QDEC_BUTTON_TRIGGER, "qdec_button"},
-	{QDEC_ROTATE_TRIGGER, "qdec_rotate"}
+static struct settings_handler peer_settings = {
+	.name = PEER_SETTINGS_ROOT,
+	.h_set = peer_settings_set,
 };
 
-static int on_send_trigger_reply(const struct coap_packet *response, struct coap_reply *reply,
-				 const struct sockaddr *from)
+static void on_provisioning_reply(otError result, otMessage *response)
+{
+	struct in6_addr addr;
+	uint16_t payload_size;
+
+	if (result != OT_ERROR_NONE) {
+		return;
+	}
+
+	payload_size = otMessageGetLength(response) - otMessageGetOffset(response);
+
+	if (payload_size != sizeof(addr) ||
+	    otMessageRead(response, otMessageGetOffset(response), &addr, sizeof(addr)) !=
+		    sizeof(addr)) {
+		LOG_ERR("Received data is invalid");
+		return;
+	}
+
+	peer_addr_update(&addr, COAP_PORT, true);
+	STATS_INC(gl_report_stats, provisioned);
+
+	LOG_INF("Received peer address: %s", unique_local_addr_str);
+
+	coap_client_send_status();
+#ifdef CONFIG_GL_STORE_FWD
+	store_fwd_replay_start();
+#endif
+}
+
+static void on_send_trigger_reply(otError result, otMessage *response)
 {
 	ARG_UNUSED(response);
-	ARG_UNUSED(reply);
-	ARG_UNUSED(from);
 
+	if (result != OT_ERROR_NONE) {
+		return;
+	}
+
+	atomic_clear(&peer_unanswered);
 	LOG_INF("Send 'trigger' done.");
-	return 0;
 }
 
 void send_trigger_event_request(trigger_event_type_e event, char* obj, void* value)
@@ -410,22 +647,29 @@ void send_trigger_event_request(trigger_event_type_e event, char* obj, void* val
 		return;
 	}
 
+#ifdef CONFIG_GL_RULES
+	/* Local rules react before, and without, the network */
+	rules_on_trigger(event, event == QDEC_ROTATE_TRIGGER ? *(double *)value : 0);
+#endif
+
 	if (!is_connected)
 	{
 		LOG_WRN("device does not connect!");
+		STATS_INC(gl_report_stats, trigger_skip);
 		return;
 	}
 
 	if(!is_testing_mode())
 	{
-		if (unique_local_addr.sin6_addr.s6_addr16[0] == 0) {
-			LOG_WRN("Peer address not set");
-			coap_client_send_provisioning_request();
+		if (!peer_addr_check()) {
+			STATS_INC(gl_report_stats, trigger_skip);
 			return;
 		}
 	}
 
-	
+	/* Called from the button handlers, do not wait for the arena */
+	gl_json_arena_begin(K_NO_WAIT);
+
 	cJSON *root_obj = cJSON_CreateObject();
 	gl_json_add_str(root_obj, "eui64", ot_get_eui64());
 
@@ -456,6 +700,7 @@ void send_trigger_event_request(trigger_event_type_e event, char* obj, void* val
 			LOG_ERR("Unknow trgger event: %d", event);
 			cJSON_Delete(event_obj);
 			cJSON_Delete(root_obj);
+			gl_json_arena_end();
 			return;
 	}
 	
@@ -465,89 +710,204 @@ void send_trigger_event_request(trigger_event_type_e event, char* obj, void* val
 
 	if(!is_testing_mode())
 	{
+		int rc;
+
 		LOG_INF("Send trigger ev: %s", payload);
-		coap_send_request(COAP_METHOD_PUT, (const struct sockaddr *)&unique_local_addr,
-				trigger_repo_option, payload, strlen(payload) + 1, on_send_trigger_reply);
+		STATS_INC(gl_report_stats, trigger);
+		peer_request_begin();
+		rc = coap_utils_send_request(OT_COAP_CODE_PUT,
+					(const otIp6Address *)&unique_local_addr.sin6_addr,
+					ntohs(unique_local_addr.sin6_port), TRIGGER_REPO_URI_PATH,
+					(const uint8_t *)payload, strlen(payload) + 1, on_send_trigger_reply);
+		peer_request_end(rc);
 		light_onoff();	
 	}else {
 		LOG_INF("Send trigger ev to testing light resource");
-		coap_send_request(COAP_METHOD_PUT, (const struct sockaddr *)&multicast_local_addr,
-				testing_light_option, payload, strlen(payload) + 1, NULL);
+		coap_utils_send_request(OT_COAP_CODE_PUT,
+					(const otIp6Address *)&multicast_local_addr.sin6_addr,
+					COAP_PORT, TESTING_LIGHT_URI_PATH,
+					(const uint8_t *)payload, strlen(payload) + 1, NULL);
 	}
 
-	free(payload); //cJSON_FreeString
+	cJSON_free(payload);
 
 end:
 	cJSON_Delete(root_obj);
+	gl_json_arena_end();
 
 	return;
 }
 
 
-static void send_provisioning_request(struct k_work *item)
+static void send_multicast_provisioning_request(struct k_work *item)
 {
 	ARG_UNUSED(item);
 
-	if (IS_ENABLED(CONFIG_OPENTHREAD_MTD_SED)) {
-		/* decrease the polling period for higher responsiveness */
-		poll_period_response_set();
+	/* The poll controller keeps a fast poll period until the reply arrives */
+	LOG_INF("Send 'provisioning' request");
+	coap_utils_send_request(OT_COAP_CODE_GET,
+				(const otIp6Address *)&multicast_local_addr.sin6_addr, COAP_PORT,
+				PROVISIONING_URI_PATH, NULL, 0u, on_provisioning_reply);
+}
+
+#ifdef CONFIG_GL_DNSSD_DISCOVERY
+static void on_server_discovered(const otIp6Address *addr, uint16_t port)
+{
+	if (addr == NULL) {
+		/* No server advertised through DNS-SD, fall back to multicast */
+		k_work_submit_to_queue(&gl_workq_lo, &provisioning_multicast_work);
+		return;
 	}
 
-	LOG_INF("Send 'provisioning' request");
-	coap_send_request(COAP_METHOD_GET, (const struct sockaddr *)&multicast_local_addr,
-			  provisioning_option, NULL, 0u, on_provisioning_reply);
+	peer_addr_update((const struct in6_addr *)addr, port, true);
+	STATS_INC(gl_report_stats, provisioned);
+	LOG_INF("Discovered peer address: %s", unique_local_addr_str);
+
+	coap_client_send_status();
+#ifdef CONFIG_GL_STORE_FWD
+	store_fwd_replay_start();
+#endif
 }
+#endif
 
-static void do_factory_reset(struct k_work *item)
+static void send_provisioning_request(struct k_work *item)
 {
 	ARG_UNUSED(item);
 
+	STATS_INC(gl_report_stats, provisioning);
+
+#ifdef CONFIG_GL_DNSSD_DISCOVERY
+	if (dnssd_server_discover(on_server_discovered) == 0) {
+		return;
+	}
+#endif
+	send_multicast_provisioning_request(NULL);
+}
+
+static void do_factory_reset(void)
+{
 #ifdef CONFIG_OPENTHREAD_SRP_CLIENT
+	/* Waits for the server to confirm the removal */
 	srp_utils_host_remove();
 #endif
-	k_sleep(K_MSEC(1000));
-
+#ifdef CONFIG_GL_PERSIST
+	persist_clear();
+#endif
 	ot_factoryreset();
+}
 
-	return;
+static void do_reboot(void)
+{
+#ifdef CONFIG_GL_PERSIST
+	/* Do not lose the changes still waiting for the coalesced write */
+	persist_flush();
+#endif
+	sys_reboot(SYS_REBOOT_WARM);
 }
 
-static int on_send_status_reply(const struct coap_packet *response, struct coap_reply *reply,
-				 const struct sockaddr *from)
+static void on_send_status_reply(otError result, otMessage *response)
 {
 	ARG_UNUSED(response);
-	ARG_UNUSED(reply);
-	ARG_UNUSED(from);
 
+	if (result != OT_ERROR_NONE) {
+		return;
+	}
+
+	atomic_clear(&peer_unanswered);
 	LOG_INF("Send 'status' done.");
-	return 0;
 }
 
-static void do_report_status_request(struct k_work *item)
+#ifdef CONFIG_GL_REPORT_LINK_TELEMETRY
+static void add_link_telemetry(cJSON *root_obj)
 {
-	ARG_UNUSED(item);
-	char *payload;
+	struct ot_link_telemetry telemetry;
 
-	if (!is_connected)
-		return;
-	if (unique_local_addr.sin6_addr.s6_addr16[0] == 0) {
-		LOG_WRN("Peer address not set");
-		coap_client_send_provisioning_request();
+	if (ot_get_link_telemetry(&telemetry) != 0) {
 		return;
 	}
 
-	gl_sensor_sample_fetch();
+	cJSON *link_obj = cJSON_CreateObject();
+	if (telemetry.has_parent) {
+		gl_json_add_number(link_obj, "parent", telemetry.parent_rloc16);
+		gl_json_add_number(link_obj, "rssi", telemetry.parent_rssi);
+		gl_json_add_number(link_obj, "avg_rssi", telemetry.parent_avg_rssi);
+		gl_json_add_number(link_obj, "lm", telemetry.link_margin);
+		gl_json_add_number(link_obj, "lqi", telemetry.parent_lqi);
+		gl_json_add_number(link_obj, "fer", telemetry.parent_frame_err_rate);
+	}
+	gl_json_add_number(link_obj, "tx", telemetry.tx_total);
+	gl_json_add_number(link_obj, "retry", telemetry.tx_retry);
+	gl_json_add_number(link_obj, "cca_fail", telemetry.tx_err_cca);
+	gl_json_add_number(link_obj, "nbr", telemetry.neighbors);
+#ifdef CONFIG_OPENTHREAD_FTD
+	gl_json_add_number(link_obj, "child", telemetry.children);
+#endif
+	gl_json_add_obj(root_obj, "link", link_obj);
+}
+#endif
 
-	cJSON *root_obj = cJSON_CreateObject();
+/* Largest status report */
+#define STATUS_PAYLOAD_SIZE 768
+
+/* The identity members of the status report only change with these */
+#define IDENTITY_CHANGED_FLAGS                                                                     \
+	(OT_CHANGED_THREAD_ROLE | OT_CHANGED_THREAD_LL_ADDR | OT_CHANGED_THREAD_ML_ADDR |          \
+	 OT_CHANGED_THREAD_RLOC_ADDED)
+
+/* Identity members of the status report, encoded without the braces. Only
+ * used from the low priority work queue, rebuilt when identity_gen moves.
+ */
+static char identity_json[320];
+static size_t identity_json_len;
+static atomic_val_t identity_built_gen;
+static atomic_t identity_gen = ATOMIC_INIT(1);
+
+static const char *identity_json_get(size_t *len)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	atomic_val_t gen = atomic_get(&identity_gen);
+	cJSON *root_obj;
+
+	if (identity_built_gen == gen) {
+		*len = identity_json_len;
+		return identity_json;
+	}
+
+	root_obj = cJSON_CreateObject();
+	openthread_api_mutex_lock(context);
 	gl_json_add_str(root_obj, "version", ot_get_version());
 	gl_json_add_number(root_obj, "thread_version", ot_get_thread_version());
 	gl_json_add_str(root_obj, "eui64", ot_get_eui64());
 	gl_json_add_str(root_obj, "extaddr", ot_get_extaddr());
 	gl_json_add_str(root_obj, "addr", ot_get_mleid());
 	gl_json_add_number(root_obj, "rloc16", ot_get_rloc16());
+	openthread_api_mutex_unlock(context);
 	gl_json_add_str(root_obj, "sw_ver", CONFIG_SW_VERSION);
-	gl_json_add_number(root_obj, "report_intervel", report_interval_second);
 	gl_json_add_str(root_obj, "dev_fw_type", ot_get_device_type());
+
+	if (cJSON_PrintPreallocated(root_obj, identity_json, sizeof(identity_json), false)) {
+		identity_json_len = strlen(identity_json) - 2;
+		memmove(identity_json, &identity_json[1], identity_json_len);
+		identity_json[identity_json_len] = '\0';
+		identity_built_gen = gen;
+	} else {
+		LOG_ERR("Identity does not fit into %zu bytes", sizeof(identity_json));
+		identity_json_len = 0;
+	}
+
+	cJSON_Delete(root_obj);
+
+	*len = identity_json_len;
+	return identity_json;
+}
+
+/* Members of the status report that change from one report to the next */
+static cJSON *status_json_create(void)
+{
+	gl_sensor_sample_fetch();
+
+	cJSON *root_obj = cJSON_CreateObject();
+	gl_json_add_number(root_obj, "report_intervel", report_interval_second);
 	cJSON *data_obj = cJSON_CreateObject();
 	gl_json_add_number(data_obj, "temperature", gl_sensor_get_temp());
 	gl_json_add_number(data_obj, "humidity", gl_sensor_get_humi());
@@ -555,266 +915,601 @@ static void do_report_status_request(struct k_work *item)
 	gl_json_add_number(data_obj, "press", gl_sensor_get_press());
 	gl_json_add_number(data_obj, "battery_level", gl_battery_get_level());
 	gl_json_add_obj(root_obj, "data", data_obj);
-	payload = cJSON_PrintUnformatted(root_obj);
+#ifdef CONFIG_GL_REPORT_LINK_TELEMETRY
+	add_link_telemetry(root_obj);
+#endif
+	return root_obj;
+}
+
+/* Splices the cached identity and the changing members into one report */
+static int status_print(char *buf, size_t size)
+{
+	size_t identity_len;
+	const char *identity = identity_json_get(&identity_len);
+	char *members = buf;
+	cJSON *root_obj;
+	int ret = 0;
+
+	if (identity_len) {
+		if (identity_len + 2 > size) {
+			return -ENOMEM;
+		}
+
+		buf[0] = '{';
+		memcpy(&buf[1], identity, identity_len);
+		members = &buf[1 + identity_len];
+	}
 
-	LOG_INF("Send 'status' request to: %s, payload: %s", unique_local_addr_str, payload);
-	coap_send_request(COAP_METHOD_PUT, (const struct sockaddr *)&unique_local_addr,
-			  status_option, payload, strlen(payload) + 1, on_send_status_reply);
+	root_obj = status_json_create();
+	if (!cJSON_PrintPreallocated(root_obj, members, size - (members - buf), false)) {
+		ret = -ENOMEM;
+	} else if (members != buf) {
+		/* The opening brace of the changing members becomes the separator */
+		members[0] = ',';
+	}
 
-	free(payload); //cJSON_FreeString
 	cJSON_Delete(root_obj);
 
-	light_onoff();
+	return ret;
 }
 
-static void toggle_minimal_sleepy_end_device(struct k_work *item)
+#ifdef CONFIG_GL_COAP_OBSERVE
+static int build_status_representation(char *buf, size_t size)
 {
-	otError error;
-	otLinkModeConfig mode;
-	struct openthread_context *context = openthread_get_default_context();
+	int ret;
 
-	__ASSERT_NO_MSG(context != NULL);
-
-	openthread_api_mutex_lock(context);
-	mode = otThreadGetLinkMode(context->instance);
-	mode.mRxOnWhenIdle = !mode.mRxOnWhenIdle;
-	error = otThreadSetLinkMode(context->instance, mode);
-	openthread_api_mutex_unlock(context);
+	gl_json_arena_begin(K_FOREVER);
+	ret = status_print(buf, size);
+	gl_json_arena_end();
 
-	if (error != OT_ERROR_NONE) {
-		LOG_ERR("Failed to set MLE link mode configuration");
-	} else {
-		on_mtd_mode_toggle(mode.mRxOnWhenIdle);
+	if (ret) {
+		LOG_ERR("Status does not fit into %zu bytes", size);
 	}
+
+	return ret;
 }
+#endif
 
-static void update_device_state(void)
+#ifdef CONFIG_GL_STORE_FWD
+static void on_send_history_reply(otError result, otMessage *response)
 {
-	struct otInstance *instance = openthread_get_default_instance();
-	otLinkModeConfig mode = otThreadGetLinkMode(instance);
-	on_mtd_mode_toggle(mode.mRxOnWhenIdle);
+	ARG_UNUSED(response);
+
+	if (result == OT_ERROR_NONE) {
+		atomic_clear(&peer_unanswered);
+		LOG_INF("Send 'history' done.");
+	}
+
+	store_fwd_replay_done(result == OT_ERROR_NONE);
 }
 
-static void on_thread_state_changed(uint32_t flags, void *context)
+/* Largest history request, keeps it within one 1280 byte IPv6 packet */
+#define HISTORY_PAYLOAD_SIZE 640
+
+static int send_history_request(const struct store_fwd_sample *samples, int count)
 {
-	struct openthread_context *ot_context = context;
+	cJSON *root_obj, *samples_arr, *sample_obj, *data_obj;
+	char *payload = NULL;
+	int ret = -ENOMEM;
 
-	if (flags & OT_CHANGED_THREAD_ROLE) {
-		switch (otThreadGetDeviceRole(ot_context->instance)) {
-		case OT_DEVICE_ROLE_CHILD:
-		case OT_DEVICE_ROLE_ROUTER:
-		case OT_DEVICE_ROLE_LEADER:
-			k_work_submit(&on_connect_work);
-			is_connected = true;
-			coap_client_send_provisioning_request();
-			ot_print_network_info();
-#ifdef CONFIG_OPENTHREAD_SRP_CLIENT
-			if (!is_srp_client_running) {
-				// Set host name
-				srp_utils_set_host_name(ot_get_extaddr());
-
-				// Set host address
-				char *ipaddr = ot_get_slaac_addr();
-				if (strlen(ipaddr) == 0) {
-					ipaddr = ot_get_mleid();
-				}
-				srp_utils_set_host_address(ipaddr);
-
-				// Set service
-				char instance[128] = {0};
-				strcat(instance, "GL_TDB_");
-				strcat(instance, ot_get_extaddr());
-				srp_utils_add_service(instance, "_coap._udp", 12345);
-
-				srp_utils_autostart(do_after_srp_srv_reg);
-
-				is_srp_client_running = true;
-			}
-#endif
-			break;
+	if (!is_connected || !peer_addr_check()) {
+		return -ENOTCONN;
+	}
 
-		case OT_DEVICE_ROLE_DISABLED:
-		case OT_DEVICE_ROLE_DETACHED:
-			k_work_submit(&on_disconnect_work);
-			is_connected = false;
-			unique_local_addr.sin6_addr.s6_addr16[0] = 0;
-		default:
+	gl_json_arena_begin(K_FOREVER);
+
+	/* Times are boot counter and uptime, the server maps them to its clock */
+	root_obj = cJSON_CreateObject();
+	gl_json_add_str(root_obj, "eui64", ot_get_eui64());
+	gl_json_add_number(root_obj, "boot", store_fwd_boot());
+	gl_json_add_number(root_obj, "uptime", k_uptime_get() / MSEC_PER_SEC);
+	samples_arr = cJSON_CreateArray();
+	for (int i = 0; i < count; i++) {
+		sample_obj = cJSON_CreateObject();
+		gl_json_add_number(sample_obj, "boot", samples[i].boot);
+		gl_json_add_number(sample_obj, "uptime", samples[i].uptime);
+		data_obj = cJSON_CreateObject();
+		gl_json_add_number(data_obj, "temperature", samples[i].temperature);
+		gl_json_add_number(data_obj, "humidity", samples[i].humidity);
+		gl_json_add_number(data_obj, "light", samples[i].light);
+		gl_json_add_number(data_obj, "press", samples[i].press);
+		gl_json_add_number(data_obj, "battery_level", samples[i].battery_level);
+		gl_json_add_obj(sample_obj, "data", data_obj);
+		cJSON_AddItemToArray(samples_arr, sample_obj);
+	}
+	gl_json_add_obj(root_obj, "samples", samples_arr);
+
+	/* Drop samples from the end until the request fits, they go in the next batch */
+	payload = cJSON_malloc(HISTORY_PAYLOAD_SIZE);
+	while (payload != NULL &&
+	       !cJSON_PrintPreallocated(root_obj, payload, HISTORY_PAYLOAD_SIZE, false)) {
+		if (--count == 0) {
+			ret = -EMSGSIZE;
 			break;
 		}
+		cJSON_DeleteItemFromArray(samples_arr, count);
+	}
+	cJSON_Delete(root_obj);
+	if (payload == NULL || count == 0) {
+		LOG_ERR("Failed to build history report");
+		goto end;
 	}
 
-	if (flags & OT_CHANGED_JOINER_STATE) {
-		int state = otJoinerGetState(ot_context->instance);
-		switch (state) {
-		case OT_JOINER_STATE_IDLE:
-		{
-			static int try_join_time = 0;
-			
-			try_join_time++;
-			if(try_join_time > 1000)
-			{	
-				try_join_time = 0;
-				led_off(LED2);
-				if (!is_joined) {
-					LOG_WRN("Join failed");
-					is_joined = false;
-				}
-			}else{
-				if(k_uptime_get_32() - join_time_start <= JOIN_COMMISSIONING_TIMEOUT){
-					LOG_INF("Start joiner again... %d", try_join_time);
-					start_joiner();
-				}else{
-					led_toggle_stop();
-				}
-			}
-			break;
-		}
-		case OT_JOINER_STATE_JOINED:
-			is_joined = true;
-			break;
-		default:
-			break;
-		}
+	LOG_INF("Send 'history' request to: %s, %d samples", unique_local_addr_str, count);
+	STATS_INC(gl_report_stats, history);
+	peer_request_begin();
+	ret = coap_utils_send_request(OT_COAP_CODE_PUT,
+				      (const otIp6Address *)&unique_local_addr.sin6_addr,
+				      ntohs(unique_local_addr.sin6_port), HISTORY_URI_PATH,
+				      (const uint8_t *)payload, strlen(payload) + 1,
+				      on_send_history_reply);
+	peer_request_end(ret);
+	/* Without a reply slot the replay times out and sends the batch again */
+	if (ret == 0 || ret == COAP_UTILS_UNTRACKED) {
+		ret = count;
 	}
+
+end:
+	cJSON_free(payload);
+	gl_json_arena_end();
+
+	return ret;
 }
 
-static void submit_work_if_connected(struct k_work *work)
+/* Keeps the sample of a report that could not be sent */
+static void store_status_sample(void)
 {
-	if (is_connected) {
-		k_work_submit(work);
-	} else {
-		LOG_INF("Connection is broken");
+	struct store_fwd_sample sample;
+
+	gl_sensor_sample_fetch();
+
+	sample.temperature = gl_sensor_get_temp();
+	sample.humidity = gl_sensor_get_humi();
+	sample.light = gl_sensor_get_light();
+	sample.press = gl_sensor_get_press();
+	sample.battery_level = gl_battery_get_level();
+
+	if (store_fwd_push(&sample) == 0) {
+		STATS_INC(gl_report_stats, stored);
+		LOG_INF("Detached, sample stored (%zu queued)", store_fwd_count());
 	}
 }
+#endif
 
-static otError coap_send_utils(otMessage *request_message, const otMessageInfo *message_info,
-			       const void *payload, uint16_t payload_size)
+static void do_report_status_request(struct k_work *item)
 {
-	otError error = OT_ERROR_NO_BUFS;
-	otMessage *response;
+	ARG_UNUSED(item);
+	char *payload;
+	int rc;
 
-	response = otCoapNewMessage(srv_context.ot, NULL);
-	if (response == NULL) {
-		LOG_ERR("otCoapNewMessage failed.");
-		goto end;
+	if (!is_connected) {
+		STATS_INC(gl_report_stats, status_skip);
+#ifdef CONFIG_GL_STORE_FWD
+		store_status_sample();
+#endif
+		return;
 	}
 
-	otCoapMessageInit(response, OT_COAP_TYPE_NON_CONFIRMABLE, OT_COAP_CODE_CONTENT);
+	gl_json_arena_begin(K_FOREVER);
 
-	error = otCoapMessageSetToken(response, otCoapMessageGetToken(request_message),
-				      otCoapMessageGetTokenLength(request_message));
-	if (error != OT_ERROR_NONE) {
-		LOG_ERR("otCoapMessageSetToken failed.");
+	payload = cJSON_malloc(STATUS_PAYLOAD_SIZE);
+	if (payload == NULL || status_print(payload, STATUS_PAYLOAD_SIZE)) {
+		LOG_ERR("Failed to build status report");
 		goto end;
 	}
 
-	error = otCoapMessageSetPayloadMarker(response);
-	if (error != OT_ERROR_NONE) {
-		LOG_ERR("otCoapMessageSetPayloadMarker failed.");
-		goto end;
+#ifdef CONFIG_GL_COAP_OBSERVE
+	/* Generated once for the peer and every observer */
+	coap_observe_notify((const uint8_t *)payload, strlen(payload) + 1);
+#endif
+
+	if (peer_addr_check()) {
+		LOG_INF("Send 'status' request to: %s, payload: %s", unique_local_addr_str,
+			payload);
+		STATS_INC(gl_report_stats, status);
+		peer_request_begin();
+		rc = coap_utils_send_request(OT_COAP_CODE_PUT,
+					(const otIp6Address *)&unique_local_addr.sin6_addr,
+					ntohs(unique_local_addr.sin6_port), STATUS_URI_PATH,
+					(const uint8_t *)payload, strlen(payload) + 1,
+					on_send_status_reply);
+		peer_request_end(rc);
+		light_onoff();
+	} else {
+		STATS_INC(gl_report_stats, status_skip);
 	}
 
-	error = otMessageAppend(response, payload, payload_size);
-	if (error != OT_ERROR_NONE) {
-		LOG_ERR("otMessageAppend failed.");
-		goto end;
+end:
+	cJSON_free(payload);
+	gl_json_arena_end();
+}
+
+#ifdef CONFIG_GL_SENML_REPORT
+enum {
+	SENML_REPLY_NONE,
+	SENML_REPLY_ACKED,
+	SENML_REPLY_FAILED,
+};
+
+static uint8_t senml_buf[CONFIG_GL_SENML_PACK_SIZE];
+/* Samples of the pack waiting for its reply, only used from the low priority work queue */
+static int senml_inflight;
+static atomic_t senml_reply = ATOMIC_INIT(SENML_REPLY_NONE);
+
+static void on_send_senml_reply(otError result, otMessage *response)
+{
+	ARG_UNUSED(response);
+
+	if (result != OT_ERROR_NONE) {
+		/* The samples are kept and sent again on the next report */
+		LOG_WRN("Send 'senml' failed: %d", result);
+		atomic_set(&senml_reply, SENML_REPLY_FAILED);
+		return;
 	}
 
-	error = otCoapSendResponse(srv_context.ot, response, message_info);
-	if (error != OT_ERROR_NONE) {
-		LOG_ERR("otCoapSendResponse failed.");
+	atomic_clear(&peer_unanswered);
+	LOG_INF("Send 'senml' done.");
+
+	/* Release the samples and send what did not fit into the pack */
+	atomic_set(&senml_reply, SENML_REPLY_ACKED);
+	k_work_submit_to_queue(&gl_workq_lo, &report_senml_work);
+}
+
+/* Sends the buffered samples, one pack per run. A pack is only released
+ * once the peer acknowledged it.
+ */
+static void do_report_senml(struct k_work *item)
+{
+	size_t len;
+	int samples;
+	int rc;
+
+	ARG_UNUSED(item);
+
+	switch (atomic_set(&senml_reply, SENML_REPLY_NONE)) {
+	case SENML_REPLY_ACKED:
+		senml_pack_release(senml_inflight);
+		senml_inflight = 0;
+		break;
+	case SENML_REPLY_FAILED:
+		senml_inflight = 0;
+		break;
+	default:
+		break;
 	}
-	// LOG_HEXDUMP_INF(payload, payload_size, "Sent provisioning response:");
-	LOG_INF("Sent provisioning response: %d, %s", payload_size, (char *)payload);
 
-end:
-	if (error != OT_ERROR_NONE && response != NULL) {
-		otMessageFree(response);
+	if (senml_inflight) {
+		/* Still waiting for the reply to the last pack */
+		return;
+	}
+
+	if (!senml_pending() || !is_connected || !peer_addr_check())
+		return;
+
+	samples = senml_pack_encode(senml_buf, sizeof(senml_buf), ot_get_eui64(), &len);
+	if (samples <= 0) {
+		return;
+	}
+
+	LOG_INF("Send 'senml' request to: %s, %d samples, %zu bytes", unique_local_addr_str,
+		samples, len);
+	peer_request_begin();
+	rc = coap_utils_send_request_format(OT_COAP_CODE_PUT,
+					    (const otIp6Address *)&unique_local_addr.sin6_addr,
+					    ntohs(unique_local_addr.sin6_port), SENML_URI_PATH,
+					    SENML_CONTENT_FORMAT, senml_buf, len, on_send_senml_reply);
+	peer_request_end(rc);
+	if (rc) {
+		return;
 	}
 
-	return error;
+	senml_inflight = samples;
+	STATS_INC(gl_report_stats, senml);
+	light_onoff();
 }
 
-static void cmd_request_handler(void *context, otMessage *message,
-				const otMessageInfo *message_info)
+static void on_senml_full(void)
 {
-	char buf[1500];
-	int length;
-	int ret = -1;
+	/* Already on the low priority queue, the connection is checked by the work */
+	k_work_submit_to_queue(&gl_workq_lo, &report_senml_work);
+}
+#endif
 
-	ARG_UNUSED(context);
+static void toggle_minimal_sleepy_end_device(struct k_work *item)
+{
+	otError error;
+	otLinkModeConfig mode;
+	struct openthread_context *context = openthread_get_default_context();
 
-	if (otCoapMessageGetType(message) != OT_COAP_TYPE_NON_CONFIRMABLE) {
-		LOG_ERR("Light handler - Unexpected type of message");
-		goto end;
+	__ASSERT_NO_MSG(context != NULL);
+
+	openthread_api_mutex_lock(context);
+	mode = otThreadGetLinkMode(context->instance);
+	mode.mRxOnWhenIdle = !mode.mRxOnWhenIdle;
+	error = otThreadSetLinkMode(context->instance, mode);
+	openthread_api_mutex_unlock(context);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to set MLE link mode configuration");
+	} else {
+		on_mtd_mode_toggle(mode.mRxOnWhenIdle);
+#ifdef CONFIG_GL_PERSIST
+		persist_mark(PERSIST_LINK_MODE);
+#endif
 	}
+}
 
-	if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
-		LOG_ERR("Light handler - Unexpected CoAP code");
-		goto end;
+static void update_device_state(void)
+{
+	struct otInstance *instance = openthread_get_default_instance();
+	otLinkModeConfig mode = otThreadGetLinkMode(instance);
+	on_mtd_mode_toggle(mode.mRxOnWhenIdle);
+}
+
+/********************************************************************************************
+ * 									Connectivity State Machine
+********************************************************************************************/
+struct conn_event {
+	uint32_t flags;
+	otDeviceRole role;
+	otJoinerState joiner_state;
+	uint32_t posted_at;
+};
+
+K_MSGQ_DEFINE(conn_event_msgq, sizeof(struct conn_event), CONN_EVENT_QUEUE_SIZE, 4);
+static K_THREAD_STACK_DEFINE(conn_sm_stack_area, CONFIG_GL_CONN_SM_STACK_SIZE);
+static struct k_thread conn_sm_thread_data;
+
+#ifdef CONFIG_OPENTHREAD_SRP_CLIENT
+static void conn_sm_srp_start(void)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	if (is_srp_client_running) {
+		return;
 	}
-	length = otMessageRead(message, otMessageGetOffset(message), buf, sizeof(buf) - 1);
-	buf[length] = '\0';
 
-	LOG_INF("Received cmd request: %s", buf);
+	openthread_api_mutex_lock(context);
 
-	otError error;
-	otMessageInfo msg_info;
-	msg_info = *message_info;
+	// Set host name
+	srp_utils_set_host_name(ot_get_extaddr());
 
-	char* resp;
-	int resp_len;
+	// Set host address
+	char *ipaddr = ot_get_slaac_addr();
+	if (strlen(ipaddr) == 0) {
+		ipaddr = ot_get_mleid();
+	}
+	srp_utils_set_host_address(ipaddr);
 
-	cJSON *resp_obj = cJSON_CreateObject();
-	ret = srv_context.cmd_request(buf, resp_obj);
+	// Set service
+	char instance[128] = {0};
+	strcat(instance, "GL_TDB_");
+	strcat(instance, ot_get_extaddr());
+	srp_utils_add_service(instance, "_coap._udp", 12345);
 
-	resp = cJSON_PrintUnformatted(resp_obj);
+	srp_utils_autostart(do_after_srp_srv_reg);
 
-	if (ret == CONFIG_CMD_FACTORYRESET) {
+	openthread_api_mutex_unlock(context);
+
+	is_srp_client_running = true;
+}
+#endif
 
-		error = coap_send_utils(message, &msg_info, resp, strlen(resp));
-		if (error != OT_ERROR_NONE) {
-			LOG_INF("coap_send_utils failed. error = %d", error);
-			goto end;
+static void conn_sm_handle_role(otDeviceRole role)
+{
+	struct openthread_context *context = openthread_get_default_context();
+
+	switch (role) {
+	case OT_DEVICE_ROLE_CHILD:
+	case OT_DEVICE_ROLE_ROUTER:
+	case OT_DEVICE_ROLE_LEADER:
+		k_work_submit_to_queue(&gl_workq_hi, &on_connect_work);
+		is_connected = true;
+		/* A peer restored from settings is validated by the first report */
+		if (!peer_addr_is_set()) {
+			coap_client_send_provisioning_request();
 		}
-		k_sleep(K_MSEC(1000));
+#ifdef CONFIG_GL_STORE_FWD
+		store_fwd_replay_start();
+#endif
 
-		free(resp);
-		cJSON_Delete(resp_obj);
+		openthread_api_mutex_lock(context);
+		ot_print_network_info();
+		openthread_api_mutex_unlock(context);
+#ifdef CONFIG_OPENTHREAD_SRP_CLIENT
+		conn_sm_srp_start();
+#endif
+		break;
 
-		k_work_submit(&factory_reset_work);
+	case OT_DEVICE_ROLE_DISABLED:
+	case OT_DEVICE_ROLE_DETACHED:
+		k_work_submit_to_queue(&gl_workq_hi, &on_disconnect_work);
+		is_connected = false;
+	default:
+		break;
+	}
+}
 
-		return;
+static void conn_sm_handle_joiner(otJoinerState state)
+{
+	switch (state) {
+	case OT_JOINER_STATE_IDLE:
+		if (is_joined) {
+			break;
+		}
 
-	} else if (ret == CONFIG_CMD_REBOOT) {
+		/* Back off instead of hammering the commissioner */
+		if (!joiner_sched_retry()) {
+			/* Only slow retries are left */
+			LOG_WRN("Join failed");
+			led_toggle_stop();
+			led_off(LED2);
+		}
+		break;
+	case OT_JOINER_STATE_JOINED:
+		is_joined = true;
+		joiner_sched_joined();
+		break;
+	default:
+		break;
+	}
+}
+
+static void conn_sm_thread(void)
+{
+	struct conn_event evt;
+
+	while (1) {
+		k_msgq_get(&conn_event_msgq, &evt, K_FOREVER);
+
+		LOG_DBG("State event 0x%08x dispatched after %uus", evt.flags,
+			k_cyc_to_us_floor32(k_cycle_get_32() - evt.posted_at));
+
+		if (evt.flags & OT_CHANGED_THREAD_ROLE) {
+			conn_sm_handle_role(evt.role);
+		}
 
-		error = coap_send_utils(message, &msg_info, resp, strlen(resp));
-		if (error != OT_ERROR_NONE) {
-			LOG_INF("coap_send_utils failed. error = %d", error);
-			goto end;
+		if (evt.flags & OT_CHANGED_JOINER_STATE) {
+			conn_sm_handle_joiner(evt.joiner_state);
 		}
-		k_sleep(K_MSEC(3000));
+	}
+}
 
-		free(resp);
-		cJSON_Delete(resp_obj);
+/* Runs on the OpenThread thread: only snapshot the state and hand it over */
+static void on_thread_state_changed(uint32_t flags, void *context)
+{
+	struct openthread_context *ot_context = context;
+	struct conn_event evt = {
+		.flags = flags,
+		.posted_at = k_cycle_get_32(),
+	};
 
-		sys_reboot(SYS_REBOOT_WARM);
+	if (flags & IDENTITY_CHANGED_FLAGS) {
+		atomic_inc(&identity_gen);
+	}
 
+	if (!(flags & (OT_CHANGED_THREAD_ROLE | OT_CHANGED_JOINER_STATE))) {
 		return;
 	}
 
+	evt.role = otThreadGetDeviceRole(ot_context->instance);
+	evt.joiner_state = otJoinerGetState(ot_context->instance);
 
-	error = coap_send_utils(message, &msg_info, resp, strlen(resp));
+	if (k_msgq_put(&conn_event_msgq, &evt, K_NO_WAIT)) {
+		LOG_ERR("Connectivity event queue full, dropped 0x%08x", flags);
+	}
+
+	LOG_DBG("State callback took %uus",
+		k_cyc_to_us_floor32(k_cycle_get_32() - evt.posted_at));
+}
+
+static void submit_work_if_connected(struct k_work *work)
+{
+	if (is_connected) {
+		k_work_submit_to_queue(&gl_workq_lo, work);
+	} else {
+		LOG_INF("Connection is broken");
+	}
+}
+
+/* Runs a cmd request on the low priority work queue, see coap_exec_submit() */
+static void cmd_request_execute(const char *payload, const struct coap_block_reply *reply)
+{
+	otError error;
+	char* resp;
+	int ret;
+
+	gl_json_arena_begin(K_FOREVER);
+
+	cJSON *resp_obj = cJSON_CreateObject();
+	ret = srv_context.cmd_request(payload, resp_obj);
+
+	resp = cJSON_PrintUnformatted(resp_obj);
+	if (resp == NULL) {
+		LOG_ERR("Failed to print cmd response");
+		coap_block_reply_tx(reply, NULL, 0);
+		STATS_INC(gl_coap_stats, rsp_err);
+		goto end;
+	}
+
+	error = coap_block_reply_tx(reply, resp, strlen(resp));
 	if (error != OT_ERROR_NONE) {
-		LOG_INF("coap_send_utils failed. error = %d", error);
+		LOG_INF("coap_block_reply_tx failed. error = %d", error);
+		STATS_INC(gl_coap_stats, rsp_err);
+		goto end;
+	}
+	STATS_INC(gl_coap_stats, rsp_tx);
+	LOG_INF("Sent cmd response: %zu, %s", strlen(resp), resp);
+	coap_dedup_record(reply, resp, strlen(resp));
+
+	/* Acknowledge first, reset once the response has left the radio */
+	if (ret == CONFIG_CMD_FACTORYRESET) {
+		sched_action_after_tx(do_factory_reset);
+	} else if (ret == CONFIG_CMD_REBOOT) {
+		sched_action_after_tx(do_reboot);
 	}
 
 end:
-	free(resp);
+	cJSON_free(resp);
 	cJSON_Delete(resp_obj);
-	return;
+	gl_json_arena_end();
 }
 
+static void cmd_request_handler(void *context, otMessage *message,
+				const otMessageInfo *message_info)
+{
+	char *buf;
+
+	ARG_UNUSED(context);
+
+	if (otCoapMessageGetType(message) != OT_COAP_TYPE_NON_CONFIRMABLE) {
+		LOG_ERR("Light handler - Unexpected type of message");
+		STATS_INC(gl_coap_stats, rx_err);
+		return;
+	}
+
+	if (otCoapMessageGetCode(message) != OT_COAP_CODE_PUT) {
+		LOG_ERR("Light handler - Unexpected CoAP code");
+		STATS_INC(gl_coap_stats, rx_err);
+		return;
+	}
+
+	/* Toggles must not run twice when a request is delivered twice */
+	if (coap_dedup_check(message, message_info)) {
+		return;
+	}
+
+	/* Large commands arrive in Block1 blocks, answered until complete */
+	if (coap_block_rx(message, message_info, &buf) != COAP_BLOCK_COMPLETE) {
+		return;
+	}
+
+	LOG_INF("Received cmd request: %s", buf);
+	STATS_INC(gl_coap_stats, rx_cmd);
+
+	/* Commands drive SPI, GPIOs and the radio, keep them off the OpenThread thread.
+	 * A rejected request may be retried, only remember it once it is queued.
+	 */
+	if (coap_exec_submit(message, message_info, buf) == 0) {
+		coap_dedup_accept(message, message_info);
+	}
+}
+
+#ifdef CONFIG_GL_COAP_OBSERVE
+static void status_request_handler(void *context, otMessage *message,
+				   const otMessageInfo *message_info)
+{
+	ARG_UNUSED(context);
+
+	if (otCoapMessageGetCode(message) != OT_COAP_CODE_GET) {
+		LOG_ERR("Status handler - Unexpected CoAP code");
+		return;
+	}
+
+	coap_observe_request(message, message_info, report_interval_second);
+}
+#endif
+
 static void coap_default_handler(void *context, otMessage *message,
 				 const otMessageInfo *message_info)
 {
@@ -826,83 +1521,121 @@ static void coap_default_handler(void *context, otMessage *message,
 		"or resource");
 }
 
-static int cmd_request(const char *json_str, cJSON* resp_obj)
+/* Counts a command in the gl_cmd group */
+static void cmd_stats_inc(int cmd_id)
+{
+	switch (cmd_id) {
+	case CONFIG_CMD_ON_OFF:
+		STATS_INC(gl_cmd_stats, onoff);
+		break;
+	case CONFIG_CMD_UPGRADE:
+		STATS_INC(gl_cmd_stats, upgrade);
+		break;
+	case CONFIG_CMD_FACTORYRESET:
+		STATS_INC(gl_cmd_stats, factoryreset);
+		break;
+	case CONFIG_CMD_REBOOT:
+		STATS_INC(gl_cmd_stats, reboot);
+		break;
+	case CONFIG_CMD_CHANGE_COLOR:
+		STATS_INC(gl_cmd_stats, change_color);
+		break;
+	case CONFIG_CMD_SET_GPIO:
+		STATS_INC(gl_cmd_stats, set_gpio);
+		break;
+	case CONFIG_CMD_GET_LED_STATUS:
+		STATS_INC(gl_cmd_stats, get_led_status);
+		break;
+	case CONFIG_CMD_GET_GPIO_STATUS:
+		STATS_INC(gl_cmd_stats, get_gpio_status);
+		break;
+	case CONFIG_CMD_SET_REPORT_INTERVAL:
+		STATS_INC(gl_cmd_stats, set_report_interval);
+		break;
+	case CONFIG_CMD_SET_OT_MODE:
+		STATS_INC(gl_cmd_stats, set_ot_mode);
+		break;
+	case CONFIG_CMD_SET_TX_POWER:
+		STATS_INC(gl_cmd_stats, set_tx_power);
+		break;
+	case CONFIG_CMD_SET_RULES:
+		STATS_INC(gl_cmd_stats, set_rules);
+		break;
+	default:
+		STATS_INC(gl_cmd_stats, unknown);
+		break;
+	}
+}
+
+/* Runs one command object. Returns the cmd id of upgrade, factoryreset and
+ * reboot, which the caller acts on after responding, else ERROR_CODE_NONE.
+ */
+static int cmd_execute(cJSON *root_obj, cJSON *resp_obj)
 {
 	int ret = ERROR_CODE_NONE;
 	const char *cmd = NULL;
 	int cmd_id;
 	const char *obj = NULL;
-	cJSON *root_obj = NULL;
-
-	root_obj = cJSON_Parse(json_str);
-	if (root_obj == NULL) {
-		LOG_ERR("cJSON Parse failure");
-		ret = ERROR_CODE_INVALID_PARAMETER;
-		return ERROR_CODE_INVALID_PARAMETER;;
-	}
 
 	cmd = gl_json_get_string(root_obj, "cmd");
 	cmd_id = get_cmd_id(cmd);
+	cmd_stats_inc(cmd_id);
 	switch (cmd_id) {
 	case CONFIG_CMD_ON_OFF: {
 		obj = gl_json_get_string(root_obj, "obj");
-		if (!check_obj_valid(obj)) {
+		int obj_id = get_led_obj_id(obj);
+		if (obj_id == GL_LOOKUP_NONE) {
 			LOG_ERR("obj error");
 			ret = ERROR_CODE_INVALID_PARAMETER;
 			goto out;
 		}
 
-		for(int i = 0; i < ARRAY_SIZE(g_led_obj); i++)
+		int val = gl_json_get_int(root_obj, "val");
+		int delay_s = gl_json_get_int(root_obj, "delay");
+		if((delay_s >= 0))
 		{
-			if (0 == strcmp(g_led_obj[i].obj, obj))
+			if(0 != on_off_led_strip_with_delay(obj_id, 0, delay_s * 1000))
 			{
-				int val = gl_json_get_int(root_obj, "val");
-				int delay_s = gl_json_get_int(root_obj, "delay");
-				if((delay_s >= 0))
-				{
-					if(0 != on_off_led_strip_with_delay(g_led_obj[i].id, 0, delay_s * 1000))
-					{
-						LOG_ERR("on_off_led_strip_with_delay ERROR");
-						ret = ERROR_CODE_UNKNOW;
-						goto out;
-					}
-				}
-
-				if(0 != on_off_led_strip(g_led_obj[i].id, val))
-				{
-					LOG_ERR("on_off_led_strip ERROR");
-					ret = ERROR_CODE_UNKNOW;
-					goto out;
-				}
-				
+				LOG_ERR("on_off_led_strip_with_delay ERROR");
+				ret = ERROR_CODE_UNKNOW;
+				goto out;
 			}
 		}
 
+		if(0 != on_off_led_strip(obj_id, val))
+		{
+			LOG_ERR("on_off_led_strip ERROR");
+			ret = ERROR_CODE_UNKNOW;
+			goto out;
+		}
+#ifdef CONFIG_GL_PERSIST
+		persist_mark(PERSIST_LED_STRIP);
+#endif
+
 	} break;
 	case CONFIG_CMD_CHANGE_COLOR: {
 		obj = gl_json_get_string(root_obj, "obj");
-		if (!check_obj_valid(obj)) {
+		int obj_id = get_led_obj_id(obj);
+		if (obj_id == GL_LOOKUP_NONE) {
 			LOG_ERR("obj error");
 			ret = ERROR_CODE_INVALID_PARAMETER;
 			goto out;
 		}
 
-		for(int i = 0; i < ARRAY_SIZE(g_led_obj); i++)
+		struct led_rgb color;
+		color.r = gl_json_get_int(root_obj, "r");
+		color.g = gl_json_get_int(root_obj, "g");
+		color.b = gl_json_get_int(root_obj, "b");
+
+#ifdef CONFIG_GL_PERSIST
+		/* The color of a node that is off is kept even though this fails */
+		persist_mark(PERSIST_LED_STRIP);
+#endif
+		if(0 != update_led_strip_rgb(obj_id, &color))
 		{
-			if (0 == strcmp(g_led_obj[i].obj, obj))
-			{
-				struct led_rgb color;
-				color.r = gl_json_get_int(root_obj, "r");
-				color.g = gl_json_get_int(root_obj, "g");
-				color.b = gl_json_get_int(root_obj, "b");
-
-				if(0 != update_led_strip_rgb(g_led_obj[i].id, &color))
-				{
-					LOG_ERR("update_led_strip_rgb ERROR");
-					ret = ERROR_CODE_UNKNOW;
-					goto out;
-				}
-			}
+			LOG_ERR("update_led_strip_rgb ERROR");
+			ret = ERROR_CODE_UNKNOW;
+			goto out;
 		}
 
 	}break;
@@ -915,6 +1648,11 @@ static int cmd_request(const char *json_str, cJSON* resp_obj)
 			LOG_ERR("gl_set_gpio_status_by_name ERROR");
 			ret = ERROR_CODE_UNKNOW;
 		}
+#ifdef CONFIG_GL_PERSIST
+		else {
+			persist_mark(PERSIST_GPIO);
+		}
+#endif
 	}break;
 	case CONFIG_CMD_GET_LED_STATUS:{
 		cJSON *array_obj = cJSON_CreateArray();
@@ -952,13 +1690,13 @@ static int cmd_request(const char *json_str, cJSON* resp_obj)
 	case CONFIG_CMD_SET_REPORT_INTERVAL: {
 		obj = gl_json_get_string(root_obj, "obj");
 		int val = gl_json_get_int(root_obj, "val");
-		report_interval_second = val;
-
-		// report_interval_second = rand()%10+report_interval_second; //Try to did it random
 
-		if(val > 0){
-			k_timer_stop(&report_timer);
-			k_timer_start(&report_timer, K_MSEC(3000), K_MSEC(report_interval_second * 1000));
+		if(report_interval_valid(val)){
+			report_interval_second = val;
+			report_timer_start();
+#ifdef CONFIG_GL_PERSIST
+			persist_mark(PERSIST_REPORT_INTERVAL);
+#endif
 			LOG_INF("Successfully set report time to %d", val);
 			ret = ERROR_CODE_NONE;
 		}else{
@@ -986,6 +1724,9 @@ static int cmd_request(const char *json_str, cJSON* resp_obj)
 		
 		if(error == OT_ERROR_NONE){
 			ret = ERROR_CODE_NONE;
+#ifdef CONFIG_GL_PERSIST
+			persist_mark(PERSIST_LINK_MODE);
+#endif
 			LOG_INF("Set ot mode:%s successfully", mode_str);
 		}else if(error == OT_ERROR_INVALID_ARGS){
 			ret = ERROR_CODE_INVALID_PARAMETER;
@@ -993,11 +1734,42 @@ static int cmd_request(const char *json_str, cJSON* resp_obj)
 			ret = ERROR_CODE_UNKNOW;
 		}
 	}break;
+	case CONFIG_CMD_SET_TX_POWER: {
+		obj = gl_json_get_string(root_obj, "obj");
+		if (obj != NULL && 0 == strcmp(obj, "pin")) {
+			if (!cJSON_HasObjectItem(root_obj, "val")) {
+				ret = ERROR_CODE_INVALID_PARAMETER;
+				goto out;
+			}
+			tx_power_ctrl_pin(gl_json_get_int(root_obj, "val"));
+		} else if (obj != NULL && 0 == strcmp(obj, "auto")) {
+			tx_power_ctrl_release();
+		} else {
+			LOG_ERR("obj error");
+			ret = ERROR_CODE_INVALID_PARAMETER;
+			goto out;
+		}
+		openthread_api_mutex_lock(openthread_get_default_context());
+		cJSON_AddNumberToObjectCS(resp_obj, "tx_power", ot_get_txpower());
+		openthread_api_mutex_unlock(openthread_get_default_context());
+	}break;
+#ifdef CONFIG_GL_RULES
+	case CONFIG_CMD_SET_RULES: {
+		int count = rules_set(cJSON_GetObjectItem(root_obj, "rules"));
+
+		if (count >= 0) {
+			cJSON_AddNumberToObjectCS(resp_obj, "rules", count);
+		} else if (count == -EIO) {
+			ret = ERROR_CODE_UNKNOW;
+		} else {
+			ret = ERROR_CODE_INVALID_PARAMETER;
+		}
+	}break;
+#endif
 	case CONFIG_CMD_UPGRADE:
 	case CONFIG_CMD_FACTORYRESET:
 	case CONFIG_CMD_REBOOT:
 		cJSON_AddNumberToObjectCS(resp_obj, "err_code", ERROR_CODE_NONE);
-		cJSON_Delete(root_obj);
 		return cmd_id;
 	default:
 		break;
@@ -1006,26 +1778,117 @@ static int cmd_request(const char *json_str, cJSON* resp_obj)
 	LOG_INF("cmd_id = %d, cmd = %s, obj = %s", cmd_id, cmd, obj);
 
 out:
+	if (ret != ERROR_CODE_NONE) {
+		STATS_INC(gl_cmd_stats, failed);
+	}
 	cJSON_AddNumberToObjectCS(resp_obj, "err_code", ret);
-end:
-	cJSON_Delete(root_obj);
 	return ERROR_CODE_NONE;
 }
 
+/* Runs the commands of a batch in order, each answered in "results". An
+ * atomic batch stops at the first failure and its LED strip changes are
+ * applied in one refresh, or not at all.
+ */
+static int cmd_batch(cJSON *root_obj, cJSON *resp_obj)
+{
+	bool atomic = !cJSON_IsArray(root_obj) &&
+		      cJSON_IsTrue(cJSON_GetObjectItem(root_obj, "atomic"));
+	cJSON *cmds = cJSON_IsArray(root_obj) ? root_obj : cJSON_GetObjectItem(root_obj, "batch");
+	cJSON *results;
+	cJSON *item;
+	int action = ERROR_CODE_NONE;
+	int ret = ERROR_CODE_NONE;
+
+	if (cJSON_GetArraySize(cmds) > CONFIG_GL_CMD_BATCH_MAX) {
+		LOG_ERR("Batch of %d commands is too large", cJSON_GetArraySize(cmds));
+		cJSON_AddNumberToObjectCS(resp_obj, "err_code", ERROR_CODE_INVALID_PARAMETER);
+		return ERROR_CODE_NONE;
+	}
+
+	results = cJSON_CreateArray();
+	cJSON_AddItemToObjectCS(resp_obj, "results", results);
+
+	if (atomic) {
+		led_strip_group_begin();
+	}
+
+	cJSON_ArrayForEach(item, cmds) {
+		cJSON *item_resp = cJSON_CreateObject();
+		int id = cmd_execute(item, item_resp);
+		int err = gl_json_get_int(item_resp, "err_code");
+
+		cJSON_AddItemToArray(results, item_resp);
+
+		/* Upgrade, factoryreset and reboot run once the whole batch is answered */
+		if (id != ERROR_CODE_NONE) {
+			action = id;
+		}
+
+		if (err != ERROR_CODE_NONE) {
+			ret = err;
+			if (atomic) {
+				break;
+			}
+		}
+	}
+
+	if (atomic) {
+		if (ret != ERROR_CODE_NONE) {
+			led_strip_group_abort();
+			action = ERROR_CODE_NONE;
+		} else if (led_strip_group_commit() != 0) {
+			ret = ERROR_CODE_UNKNOW;
+		}
+	}
+
+	cJSON_AddNumberToObjectCS(resp_obj, "err_code", ret);
+
+	return action;
+}
+
+static int cmd_request(const char *json_str, cJSON* resp_obj)
+{
+	cJSON *root_obj = NULL;
+	int ret;
+
+	root_obj = cJSON_Parse(json_str);
+	if (root_obj == NULL) {
+		LOG_ERR("cJSON Parse failure");
+		return ERROR_CODE_INVALID_PARAMETER;
+	}
+
+	if (cJSON_IsArray(root_obj) || cJSON_IsArray(cJSON_GetObjectItem(root_obj, "batch"))) {
+		ret = cmd_batch(root_obj, resp_obj);
+	} else {
+		ret = cmd_execute(root_obj, resp_obj);
+	}
+
+	cJSON_Delete(root_obj);
+	return ret;
+}
+
 static void on_report_timer_expiry(struct k_timer *timer_id)
 {
 	ARG_UNUSED(timer_id);
 
+	/* One-shot timer, re-armed on the device phase with fresh jitter */
+	report_deadline += report_interval_ms();
+	k_timer_start(&report_timer, report_next_delay(), K_NO_WAIT);
+
 	if (!is_connected) {
 		LOG_WRN("Network disconnect.");
+#ifdef CONFIG_GL_STORE_FWD
+		/* The report work stores the sample for later */
+		k_work_submit_to_queue(&gl_workq_lo, &report_status_work);
+#endif
 		return;
 	}
-	if (unique_local_addr.sin6_addr.s6_addr16[0] == 0) {
-		LOG_WRN("Peer address not set");
-		coap_client_send_provisioning_request();
-		return;
-	}
+	/* The peer address is checked by the report work item */
+#ifdef CONFIG_GL_SENML_REPORT
+	k_work_submit_to_queue(&gl_workq_lo, &report_senml_work);
+#else
 	coap_client_send_status();
+#endif
 }
 
 static void on_report_timer_stop(struct k_timer *timer_id)
@@ -1063,22 +1926,183 @@ void ot_link_mode_init()
 	}
 }
 
+#ifdef CONFIG_GL_PERSIST
+static size_t persist_report_interval_get(uint8_t data[PERSIST_MAX_LEN])
+{
+	memcpy(data, &report_interval_second, sizeof(report_interval_second));
+	return sizeof(report_interval_second);
+}
+
+static void persist_report_interval_set(const uint8_t *data, size_t len)
+{
+	int val;
+
+	if (len != sizeof(val)) {
+		return;
+	}
+
+	memcpy(&val, data, sizeof(val));
+	if (report_interval_valid(val)) {
+		report_interval_second = val;
+	} else {
+		LOG_WRN("Ignore stored report interval %d", val);
+	}
+}
+
+/* On/off and r, g, b of every strip node */
+static size_t persist_led_strip_get(uint8_t data[PERSIST_MAX_LEN])
+{
+	struct led_rgb color;
+	int on_off;
+	size_t len = 0;
+
+	for (uint16_t node = LED_STRIP_NODE_1; node <= LED_STRIP_NODE_2; node++) {
+		if (get_led_strip_status(node, &on_off, &color)) {
+			on_off = 0;
+			memset(&color, 0, sizeof(color));
+		}
+		data[len++] = on_off;
+		data[len++] = color.r;
+		data[len++] = color.g;
+		data[len++] = color.b;
+	}
+
+	return len;
+}
+
+static void persist_led_strip_set(const uint8_t *data, size_t len)
+{
+	struct led_rgb color;
+
+	if (len != 4 * LED_STRIP_NODE_2) {
+		return;
+	}
+
+	for (uint16_t node = LED_STRIP_NODE_1; node <= LED_STRIP_NODE_2; node++, data += 4) {
+		color = (struct led_rgb)RGB(data[1], data[2], data[3]);
+		on_off_led_strip(node, data[0] ? LED_ON : LED_OFF);
+		/* Fails for a node that is off, the color is kept for when it is on */
+		update_led_strip_rgb(node, &color);
+	}
+}
+
+static size_t persist_gpio_get(uint8_t data[PERSIST_MAX_LEN])
+{
+	size_t len = 0;
+
+	for (gl_gpio_node_e node = GPIO_015; node <= GPIO_020; node++) {
+		data[len++] = gl_get_gpio_status(node);
+	}
+
+	return len;
+}
+
+static void persist_gpio_set(const uint8_t *data, size_t len)
+{
+	if (len != GPIO_020 + 1) {
+		return;
+	}
+
+	for (gl_gpio_node_e node = GPIO_015; node <= GPIO_020; node++) {
+		gl_set_gpio_status_by_id(node, data[node]);
+	}
+}
+
+static size_t persist_link_mode_get(uint8_t data[PERSIST_MAX_LEN])
+{
+	struct openthread_context *context = openthread_get_default_context();
+	otLinkModeConfig mode;
+
+	openthread_api_mutex_lock(context);
+	mode = otThreadGetLinkMode(context->instance);
+	openthread_api_mutex_unlock(context);
+
+	data[0] = (mode.mRxOnWhenIdle ? BIT(0) : 0) | (mode.mDeviceType ? BIT(1) : 0) |
+		  (mode.mNetworkData ? BIT(2) : 0);
+
+	return 1;
+}
+
+static void persist_link_mode_set(const uint8_t *data, size_t len)
+{
+	struct openthread_context *context = openthread_get_default_context();
+	otLinkModeConfig mode;
+	otError error;
+
+	if (len != 1) {
+		return;
+	}
+
+	mode.mRxOnWhenIdle = data[0] & BIT(0);
+	mode.mDeviceType = data[0] & BIT(1);
+	mode.mNetworkData = data[0] & BIT(2);
+
+	openthread_api_mutex_lock(context);
+	error = otThreadSetLinkMode(context->instance, mode);
+	openthread_api_mutex_unlock(context);
+
+	if (error != OT_ERROR_NONE) {
+		LOG_ERR("Failed to restore link mode, error: %d", error);
+	} else if (on_mtd_mode_toggle != NULL) {
+		on_mtd_mode_toggle(mode.mRxOnWhenIdle);
+	}
+}
+
+static const struct persist_item_ops persist_ops[PERSIST_ITEMS] = {
+	[PERSIST_REPORT_INTERVAL] = { "report", persist_report_interval_get,
+				      persist_report_interval_set },
+	[PERSIST_LED_STRIP] = { "led", persist_led_strip_get, persist_led_strip_set },
+	[PERSIST_GPIO] = { "gpio", persist_gpio_get, persist_gpio_set },
+	[PERSIST_LINK_MODE] = { "mode", persist_link_mode_get, persist_link_mode_set },
+};
+#endif
+
 void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t on_disconnect,
 			    mtd_mode_toggle_cb_t on_toggle)
 {
 	on_mtd_mode_toggle = on_toggle;
 
-	coap_init(AF_INET6, NULL);
+	poll_ctrl_init();
+	coap_utils_init();
+	STATS_INIT_AND_REG(gl_cmd_stats, STATS_SIZE_32, "gl_cmd");
+	STATS_INIT_AND_REG(gl_report_stats, STATS_SIZE_32, "gl_report");
+
+	k_work_init(&peer_store_work, peer_store);
+
+	if (settings_subsys_init() == 0) {
+		settings_register(&peer_settings);
+		settings_load_subtree(PEER_SETTINGS_ROOT);
+#ifdef CONFIG_GL_STORE_FWD
+		store_fwd_init(send_history_request);
+#endif
+#ifdef CONFIG_GL_RULES
+		rules_init();
+#endif
+	}
 	ot_link_mode_init();
+#ifdef CONFIG_GL_PERSIST
+	/* Overrides the defaults above, before the first report */
+	persist_init(persist_ops);
+#endif
 
 	k_timer_init(&report_timer, on_report_timer_expiry, on_report_timer_stop);
-	k_work_init(&factory_reset_work, do_factory_reset);
+	sched_action_init();
 
 
 	k_work_init(&on_connect_work, on_connect);
 	k_work_init(&on_disconnect_work, on_disconnect);
 	k_work_init(&provisioning_work, send_provisioning_request);
+	k_work_init(&provisioning_multicast_work, send_multicast_provisioning_request);
 	k_work_init(&report_status_work, do_report_status_request);
+#ifdef CONFIG_GL_SENML_REPORT
+	k_work_init(&report_senml_work, do_report_senml);
+	senml_init(on_senml_full);
+#endif
+
+	k_thread_create(&conn_sm_thread_data, conn_sm_stack_area,
+			K_THREAD_STACK_SIZEOF(conn_sm_stack_area), (k_thread_entry_t)conn_sm_thread,
+			NULL, NULL, NULL, CONFIG_GL_CONN_SM_PRIORITY, 0, K_NO_WAIT);
+	k_thread_name_set(&conn_sm_thread_data, "conn-sm");
 
 	openthread_set_state_changed_cb(on_thread_state_changed);
 	
@@ -1099,7 +2123,14 @@ void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t
 	testing_light_resource.mContext = srv_context.ot;
 	testing_light_resource.mHandler = testing_light_request_handler;
 
+#ifdef CONFIG_GL_COAP_OBSERVE
+	status_resource.mContext = srv_context.ot;
+	status_resource.mHandler = status_request_handler;
+	coap_observe_init(build_status_representation);
+#endif
+
 	srv_context.cmd_request = cmd_request;
+	coap_exec_init(cmd_request_execute);
 	srv_context.ot = context->instance;
 	if (!srv_context.ot) {
 		LOG_ERR("There is no valid OpenThread instance");
@@ -1108,12 +2139,15 @@ void coap_client_utils_init(ot_connection_cb_t on_connect, ot_disconnection_cb_t
 	otCoapSetDefaultHandler(srv_context.ot, coap_default_handler, NULL);
 	otCoapAddResource(srv_context.ot, &cmd_resource);
 	otCoapAddResource(srv_context.ot, &testing_light_resource);
+#ifdef CONFIG_GL_COAP_OBSERVE
+	otCoapAddResource(srv_context.ot, &status_resource);
+#endif
 
 	if (otCoapStart(srv_context.ot, COAP_PORT) != OT_ERROR_NONE) {
 		LOG_ERR("Failed to start OT CoAP.");
 	}
 
-	otPlatRadioSetTransmitPower(context->instance, 8);
+	tx_power_ctrl_init();
 
 	ot_print_network_info();
 }
@@ -1131,7 +2165,7 @@ void coap_client_send_provisioning_request(void)
 void coap_client_toggle_minimal_sleepy_end_device(void)
 {
 	if (IS_ENABLED(CONFIG_OPENTHREAD_MTD_SED)) {
-		k_work_submit(&toggle_MTD_SED_work);
+		k_work_submit_to_queue(&gl_workq_hi, &toggle_MTD_SED_work);
 	}
 }
 
@@ -1146,8 +2180,7 @@ void do_after_srp_srv_reg(void)
 	smp_start();
 #endif
 
-	// report_interval_second = rand()%10 + report_interval_second;  //Try to did it random
-	k_timer_start(&report_timer, K_MSEC(3000), K_MSEC(report_interval_second * 1000));
+	report_timer_start();
 
 	return;
 }
\ No newline at end of file
@@ -29,6 +29,8 @@
 
 #define PROVISIONING_URI_PATH "provisioning"
 #define STATUS_URI_PATH "status"
+#define SENML_URI_PATH "senml"
+#define HISTORY_URI_PATH "history"
 #define TRIGGER_REPO_URI_PATH "trigger"
 
 #define TESTING_LIGHT_URI_PATH "testing_light"
@@ -41,7 +41,9 @@ enum {
     CONFIG_CMD_GET_LED_STATUS,
     CONFIG_CMD_GET_GPIO_STATUS,
     CONFIG_CMD_SET_REPORT_INTERVAL,
-    CONFIG_CMD_SET_OT_MODE
+    CONFIG_CMD_SET_OT_MODE,
+    CONFIG_CMD_SET_TX_POWER,
+    CONFIG_CMD_SET_RULES
 };
 
 enum { 
@@ -65,6 +65,8 @@
 #include "gl_button_logic.h"
 #include "gl_types.h"
 #include "gl_battery.h"
+#include "gl_joiner.h"
+#include "gl_workq.h"
 
 LOG_MODULE_REGISTER(main, CONFIG_GL_THREAD_DEV_BOARD_LOG_LEVEL);
 
@@ -82,7 +84,7 @@ static void on_ot_connect(struct k_work *item)
 		led_toggle_stop();
 	}
 
-	dk_set_led_on(LED2);
+	led_on(LED2);
 }
 
 static void on_ot_disconnect(struct k_work *item)
@@ -95,8 +97,6 @@ static void on_ot_disconnect(struct k_work *item)
 		led_toggle_stop();
 		led_toggle_start(1000);
 	}
-
-	dk_set_led_off(LED2);
 }
 
 static void on_mtd_mode_toggle(uint32_t med)
@@ -110,7 +110,11 @@ static void on_mtd_mode_toggle(uint32_t med)
 		pm_device_action_run(cons, PM_DEVICE_ACTION_SUSPEND);
 	}
 #endif
-	dk_set_led(LED2, med);
+	if (med) {
+		led_on(LED2);
+	} else {
+		led_off(LED2);
+	}
 }
 
 static struct k_work qdec_work;
@@ -156,7 +160,7 @@ void encoder_callback(const struct device *dev, const struct sensor_trigger *tri
 
 	if(abs(rotation) >= DEF_ROTATION)
 	{
-		k_work_submit(&qdec_work);
+		k_work_submit_to_queue(&gl_workq_hi, &qdec_work);
 	}
 }
 
@@ -176,7 +180,8 @@ void simulation_click(uint32_t button)
 
 void auto_join_commissioning_start()
 {
-	simulation_click(DK_BTN2_MSK);
+	/* Keep the retry budget left over from previous boots */
+	join_network_start(false);
 }
 
 void main(void)
@@ -204,6 +209,7 @@ void main(void)
 	if (ret) {
 		LOG_ERR("Could not initialize leds, err code: %d", ret);
 	}
+	gl_led_init();
 	light_off();
 
 	ret = dk_buttons_init(on_button_changed);
@@ -232,7 +238,10 @@ void main(void)
 	joiner_state = DEVICE_INITIAL;
 
 	gl_sensor_init();
+	/* Before the stored strip state is restored */
+	gl_led_strip_init();
 
+	joiner_sched_init();
 	coap_client_utils_init(on_ot_connect, on_ot_disconnect, on_mtd_mode_toggle);
 	// auto_commissioning_timer_init();
 	auto_join_commissioning_start();
@@ -240,7 +249,6 @@ void main(void)
 #ifdef CONFIG_SENSOR_VALUE_AUTO_PRINT
 	debug_sensor_data();
 #endif
-	gl_led_strip_init();
 
 	k_work_init(&qdec_work, qdec_trigger);
 	gl_qdec_init(encoder_callback);